@@ -29,6 +29,7 @@
 #define STEPPERS_ENABLE_DDR     DDRB
 #define STEPPERS_ENABLE_PORT    PORTB
 #define STEPPERS_ENABLE_BIT         0
+#define STEPPERS_ENABLE_DELAY       2 // ms to wait for re-enabled drivers to settle before stepping
 
 #define STEPPING_DDR       DDRD
 #define STEPPING_PORT      PORTD
@@ -39,23 +40,79 @@
 #define Y_DIRECTION_BIT      6
 #define Z_DIRECTION_BIT      7
 
+// Drive the spindle speed from the S word with a hardware PWM signal from Timer 2 (OC2A, Arduino
+// pin 11). OC2A is the only free PWM pin, so the PWM signal doubles as the spindle enable signal and
+// the Z limit switch moves from pin 11 to pin 12. Comment out to get the plain on/off spindle back.
+#define VARIABLE_SPINDLE
+
+// Map S words to PWM duty through a piecewise-linear table instead of the straight line between
+// settings.spindle_min_rpm and settings.spindle_max_rpm. Entries are {rpm, pwm} pairs with rising
+// rpm. Use it for spindles and VFDs with a non-linear speed response.
+// #define SPINDLE_RPM_TABLE {{0, 0}, {1000, 30}, {6000, 120}, {12000, 220}, {15000, 255}}
+
 #define LIMIT_DDR      DDRB
 #define LIMIT_PORT     PORTB
+#define LIMIT_PIN      PINB
+#define LIMIT_PCMSK    PCMSK0 // Pin change interrupt mask and enable bit of the limit port
+#define LIMIT_PCIE     PCIE0
+#define LIMIT_PCIF     PCIF0  // and its pin change interrupt flag, cleared by writing 1
 #define X_LIMIT_BIT          1
 #define Y_LIMIT_BIT          2
+#ifdef VARIABLE_SPINDLE
+#define Z_LIMIT_BIT          4
+#else
 #define Z_LIMIT_BIT          3
+#endif
 
 #define SPINDLE_ENABLE_DDR DDRB
 #define SPINDLE_ENABLE_PORT PORTB
+#ifdef VARIABLE_SPINDLE
+#define SPINDLE_ENABLE_BIT 3 // OC2A, carries the PWM signal
+#else
 #define SPINDLE_ENABLE_BIT 4
+#endif
 
 #define SPINDLE_DIRECTION_DDR DDRB
 #define SPINDLE_DIRECTION_PORT PORTB
 #define SPINDLE_DIRECTION_BIT 5
 
+// The homing cycle homes the axes in HOMING_CYCLE_0 first, then the axes in HOMING_CYCLE_1. The axes
+// in each group move simultaneously. By default Z is homed on its own first to get the tool clear of
+// the work before X and Y move. Use the *_LIMIT_BIT masks.
+#define HOMING_CYCLE_0 (1<<Z_LIMIT_BIT)
+#define HOMING_CYCLE_1 ((1<<X_LIMIT_BIT)|(1<<Y_LIMIT_BIT))
+
+// End the step pulse at the end of The Stepper Driver Interrupt, timed by the free running timer 0, 
+// instead of from a second interrupt. The work done between setting and resetting the step pins 
+// usually takes longer than short pulses anyway, so this saves an interrupt per step at high step rates. 
+// The pulse and the direction setup time are then busy-waited with interrupts disabled.
+// #define STEP_PULSE_DELAY_AND_CLEAR
+
+// The longest step pulse ($3) and direction setup time ($32) accepted, in microseconds. Busy-waits
+// hold up every other interrupt, so they are kept short. Timer 0 times up to 127.
+#ifdef STEP_PULSE_DELAY_AND_CLEAR
+#define MAX_STEP_TIMING_MICROSECONDS 20
+#else
+#define MAX_STEP_TIMING_MICROSECONDS 127
+#endif
+
+// Count the cycles spent parsing and planning, the fill of the block buffer and the times it ran
+// empty in the middle of a job. '$P' reports and resets the counters (see profile.h). Costs about
+// 1.5k of flash and a little time per line.
+// #define PROFILE
+
 // The temporal resolution of the acceleration management subsystem. Higher number
-// give smoother acceleration but may impact performance
-#define ACCELERATION_TICKS_PER_SECOND 40L
+// give smoother acceleration but may impact performance. Every tick costs a rate update in the 
+// timer 2 overflow interrupt (a table lookup and a multiplication in cycles_per_step_event(), no
+// division) and the rest of the step timer setup. At 200 ticks per second the speed follows the planned 
+// profile within 5ms steps, short blocks ramp in many small steps instead of a few coarse ones, and
+// the per-tick rate_delta stays large enough that rounding it up adds little acceleration.
+#define ACCELERATION_TICKS_PER_SECOND 200L
+
+// Between the ticks The Stepper Driver Interrupt moves the rate along the ramp from one tick to the next,
+// on every step event but at most this many times per second. Each update costs a cycles_per_step_event()
+// and a timer reload, done with interrupts enabled and only while the speed changes.
+#define RATE_UPDATES_PER_SECOND 2000L
 
 #endif
 
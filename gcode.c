@@ -31,22 +31,27 @@
 #include "spindle_control.h"
 #include "errno.h"
 #include "serial_protocol.h"
+#include "stepper.h"
+#include "config.h"
 
 #define MM_PER_INCH (25.4)
+#define PECK_CLEARANCE (0.254) // How far above the last peck G83 stops its rapid back into the hole
 
 #define NEXT_ACTION_DEFAULT 0
 #define NEXT_ACTION_DWELL 1
 #define NEXT_ACTION_GO_HOME 2
+#define NEXT_ACTION_SET_COORDINATE_DATA 3    // G10
+#define NEXT_ACTION_SET_COORDINATE_OFFSET 4  // G92
+#define NEXT_ACTION_RESET_COORDINATE_OFFSET 5 // G92.1, G92.2
 
 #define MOTION_MODE_SEEK 0 // G0 
 #define MOTION_MODE_LINEAR 1 // G1
 #define MOTION_MODE_CW_ARC 2  // G2
 #define MOTION_MODE_CCW_ARC 3  // G3
 #define MOTION_MODE_CANCEL 4 // G80
-
-#define PATH_CONTROL_MODE_EXACT_PATH 0
-#define PATH_CONTROL_MODE_EXACT_STOP 1
-#define PATH_CONTROL_MODE_CONTINOUS  2
+#define MOTION_MODE_DRILL 5 // G81, the canned cycles must come last
+#define MOTION_MODE_DRILL_DWELL 6 // G82
+#define MOTION_MODE_DRILL_PECK 7 // G83
 
 #define PROGRAM_FLOW_RUNNING 0
 #define PROGRAM_FLOW_PAUSED 1
@@ -58,19 +63,27 @@
 typedef struct {
   uint8_t status_code;
 
-  uint8_t motion_mode;             /* {G0, G1, G2, G3, G80} */
+  uint8_t motion_mode;             /* {G0, G1, G2, G3, G80, G81, G82, G83} */
   uint8_t inverse_feed_rate_mode;  /* G93, G94 */
   uint8_t inches_mode;             /* 0 = millimeter mode, 1 = inches mode {G20, G21} */
   uint8_t absolute_mode;           /* 0 = relative motion, 1 = absolute motion {G90, G91} */
   uint8_t program_flow;
   int spindle_direction;
   double feed_rate, seek_rate;     /* Millimeters/second */
-  double position[3];              /* Where the interpreter considers the tool to be at this point in the code */
+  double position[3];              /* Where the interpreter considers the tool to be at this point in the code.
+                                      In machine coordinates. */
+  uint8_t coord_select;            /* The active work coordinate system, 0 for G54 {G54-G59} */
+  double coord_system[3];          /* The offsets of the active work coordinate system (mm) */
+  double coord_offset[3];          /* The G92 offsets (mm) */
   uint8_t tool;
-  int16_t spindle_speed;           /* RPM/100 */
+  double spindle_speed;            /* RPM */
   uint8_t plane_axis_0, 
           plane_axis_1, 
           plane_axis_2;            // The axes of the selected plane  
+  uint8_t canned_retract_to_r;     /* 0 = retract to the initial height, 1 = retract to R {G98, G99} */
+  double canned_initial;           /* The height of the tool when the canned cycle began (machine coordinates) */
+  double canned_r, canned_z;       /* The R and depth words of the canned cycle as given (mm) */
+  double canned_q, canned_p;       /* The peck depth (mm) and dwell time (seconds) of the canned cycle */
 } parser_state_t;
 static parser_state_t gc;
 
@@ -96,12 +109,108 @@ void gc_init() {
   gc.seek_rate = settings.default_seek_rate/60;
   select_plane(X_AXIS, Y_AXIS, Z_AXIS);
   gc.absolute_mode = TRUE;
+  settings_read_coord_data(gc.coord_select, gc.coord_system);
 }
 
 inline float to_millimeters(double value) {
   return(gc.inches_mode ? (value * MM_PER_INCH) : value);
 }
 
+// Is the value outside the travel of the axis? The homing cycle makes the home switches machine zero and
+// each axis can travel settings.max_travel millimeters away from its switch.
+static int outside_travel(uint8_t axis, double value)
+{
+  static const uint8_t direction_bit[3] = {1<<X_DIRECTION_BIT, 1<<Y_DIRECTION_BIT, 1<<Z_DIRECTION_BIT};
+  if (settings.homing_dir_mask & direction_bit[axis]) { 
+    return((value > 0) || (value < -settings.max_travel[axis]));
+  }
+  return((value < 0) || (value > settings.max_travel[axis]));
+}
+
+// Checks a target position against the soft limits. Only two compares per axis, so it is cheap enough
+// for every block.
+static int soft_limit_violation(double *target)
+{
+  return(outside_travel(X_AXIS, target[X_AXIS]) || outside_travel(Y_AXIS, target[Y_AXIS]) || 
+    outside_travel(Z_AXIS, target[Z_AXIS]));
+}
+
+// Runs or stops the spindle as the parser state says
+static void update_spindle()
+{
+  if (gc.spindle_direction) {
+    spindle_run(gc.spindle_direction, gc.spindle_speed);
+  } else {
+    spindle_stop();
+  }
+}
+
+#ifdef __AVR_ATmega328P__
+// Checks the points of an arc where it reaches furthest along the axes of the plane. Those are the 
+// points at multiples of 90 degrees swept by the arc. (The end points are checked separately.)
+static int soft_limit_violation_arc(double *center, double radius, double theta_start, double angular_travel)
+{
+  double lo = min(theta_start, theta_start+angular_travel);
+  double hi = max(theta_start, theta_start+angular_travel);
+  uint8_t quadrant;
+  for(quadrant=0; quadrant<4; quadrant++) {
+    double theta = quadrant*M_PI_2;
+    // Wind theta to the first turn at or after lo
+    theta += ceil((lo-theta)/(2*M_PI))*2*M_PI;
+    if (theta > hi) { continue; }
+    // See mc_arc(): axis_0 follows sin(theta), axis_1 follows cos(theta)
+    switch(quadrant) {
+      case 0: if (outside_travel(gc.plane_axis_1, center[1]+radius)) { return(TRUE); } break;
+      case 1: if (outside_travel(gc.plane_axis_0, center[0]+radius)) { return(TRUE); } break;
+      case 2: if (outside_travel(gc.plane_axis_1, center[1]-radius)) { return(TRUE); } break;
+      case 3: if (outside_travel(gc.plane_axis_0, center[0]-radius)) { return(TRUE); } break;
+    }
+  }
+  return(FALSE);
+}
+#endif
+
+static void canned_move(double *position, uint8_t rapid)
+{
+  mc_line(position[X_AXIS], position[Y_AXIS], position[Z_AXIS], rapid ? gc.seek_rate : gc.feed_rate, FALSE);
+}
+
+// Expands a canned drilling cycle into motions. Drills the hole at target down to target[plane_axis_2] 
+// starting from the R plane, in pecks of peck mm with chip clearing retracts to the R plane in between
+// when peck is non-zero (G83), dwells dwell seconds at the bottom (G82) and rapids out to retract. Heights
+// are along plane_axis_2 in machine coordinates. Leaves target at where the tool ends up.
+static void canned_cycle(double *target, double r_plane, double retract, double peck, double dwell)
+{
+  uint8_t axis = gc.plane_axis_2;
+  double bottom = target[axis];
+  double position[3];
+  memcpy(position, gc.position, sizeof(position));
+  // Get up to the R plane if we are below it, then over the hole and down to the R plane
+  if (position[axis] < r_plane) { position[axis] = r_plane; canned_move(position, TRUE); }
+  position[gc.plane_axis_0] = target[gc.plane_axis_0];
+  position[gc.plane_axis_1] = target[gc.plane_axis_1];
+  canned_move(position, TRUE);
+  position[axis] = r_plane; 
+  canned_move(position, TRUE);
+  double depth = r_plane;
+  do {
+    if (depth < r_plane) {
+      // Clear the chips, then rapid back down to just above the last peck
+      position[axis] = r_plane; 
+      canned_move(position, TRUE);
+      position[axis] = min(depth+PECK_CLEARANCE, r_plane); 
+      canned_move(position, TRUE);
+    }
+    depth = (peck > 0) ? max(depth-peck, bottom) : bottom;
+    position[axis] = depth;
+    canned_move(position, FALSE);
+  } while (depth > bottom);
+  if (dwell > 0) { mc_dwell(trunc(dwell*1000)); }
+  position[axis] = retract; 
+  canned_move(position, TRUE);
+  memcpy(target, position, sizeof(position));
+}
+
 // Find the angle in radians of deviance from the positive y axis. negative angles to the left of y-axis, 
 // positive to the right.
 double theta(double x, double y)
@@ -135,10 +244,19 @@ uint8_t gc_execute_line(char *line) {
   double target[3], offset[3];  
   
   double p = 0, r = 0;
-  int int_value;
+  uint8_t p_given = FALSE;
+  int path_control_mode = -1;     // The path control mode given on this line, if any
+  uint8_t previous_motion_mode = gc.motion_mode;
+  double r_plane = 0, retract = 0; // The R plane and retract height of canned cycles
+  uint16_t repeats = 1;           // How many holes the canned cycle of this line drills (L)
+  double hole_step[3];            // How far apart the repeated holes are
+  int int_value, mantissa, l = 0;
+  uint8_t axis, axis_words = 0;   // Bits of the axes given on this line
+  double axis_value[3];           // The axis words as given (converted to mm)
   
   clear_vector(target);
   clear_vector(offset);
+  clear_vector(hole_step);
 
   gc.status_code = GCSTATUS_OK;
   
@@ -164,8 +282,10 @@ uint8_t gc_execute_line(char *line) {
   // Pass 1: Commands
   while(next_statement(&letter, &value, line, &char_counter)) {
     int_value = trunc(value);
+    mantissa = lround(10*value)-10*int_value; // The digit after the point, e.g. 1 for G92.1
     switch(letter) {
       case 'G':
+      if (mantissa && (int_value != 61) && (int_value != 92)) { FAIL(GCSTATUS_UNSUPPORTED_STATEMENT); break; }
       switch(int_value) {
         case 0: gc.motion_mode = MOTION_MODE_SEEK; break;
         case 1: gc.motion_mode = MOTION_MODE_LINEAR; break;
@@ -174,6 +294,7 @@ uint8_t gc_execute_line(char *line) {
         case 3: gc.motion_mode = MOTION_MODE_CCW_ARC; break;
 #endif        
         case 4: next_action = NEXT_ACTION_DWELL; break;
+        case 10: next_action = NEXT_ACTION_SET_COORDINATE_DATA; break;
         case 17: select_plane(X_AXIS, Y_AXIS, Z_AXIS); break;
         case 18: select_plane(X_AXIS, Z_AXIS, Y_AXIS); break;
         case 19: select_plane(Y_AXIS, Z_AXIS, X_AXIS); break;
@@ -181,10 +302,35 @@ uint8_t gc_execute_line(char *line) {
         case 21: gc.inches_mode = FALSE; break;
         case 28: case 30: next_action = NEXT_ACTION_GO_HOME; break;
         case 53: absolute_override = TRUE; break;
+        case 54: case 55: case 56: case 57: case 58: case 59:
+        // The planner works in machine coordinates, so switching needs no synchronization
+        gc.coord_select = int_value-54; 
+        settings_read_coord_data(gc.coord_select, gc.coord_system);
+        break;
+        case 61: 
+        switch(mantissa) {
+          case 0: path_control_mode = PATH_CONTROL_MODE_EXACT_PATH; break;
+          case 1: path_control_mode = PATH_CONTROL_MODE_EXACT_STOP; break;
+          default: FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);
+        }
+        break;
+        case 64: path_control_mode = PATH_CONTROL_MODE_CONTINOUS; break;
         case 80: gc.motion_mode = MOTION_MODE_CANCEL; break;
+        case 81: gc.motion_mode = MOTION_MODE_DRILL; break;
+        case 82: gc.motion_mode = MOTION_MODE_DRILL_DWELL; break;
+        case 83: gc.motion_mode = MOTION_MODE_DRILL_PECK; break;
         case 90: gc.absolute_mode = TRUE; break;
         case 91: gc.absolute_mode = FALSE; break;
+        case 92: 
+        switch(mantissa) {
+          case 0: next_action = NEXT_ACTION_SET_COORDINATE_OFFSET; break;
+          case 1: case 2: next_action = NEXT_ACTION_RESET_COORDINATE_OFFSET; break;
+          default: FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);
+        }
+        break;
         case 93: gc.inverse_feed_rate_mode = TRUE; break;
+        case 98: gc.canned_retract_to_r = FALSE; break;
+        case 99: gc.canned_retract_to_r = TRUE; break;
         case 94: gc.inverse_feed_rate_mode = FALSE; break;
         default: FAIL(GCSTATUS_UNSUPPORTED_STATEMENT);
       }
@@ -229,37 +375,154 @@ uint8_t gc_execute_line(char *line) {
       }
       break;
       case 'I': case 'J': case 'K': offset[letter-'I'] = unit_converted_value; break;
-      case 'P': p = value; break;
+      case 'L': l = int_value; break;
+      case 'P': p = value; p_given = TRUE; break;
+      case 'Q': gc.canned_q = unit_converted_value; break;
       case 'R': r = unit_converted_value; radius_mode = TRUE; break;
-      case 'S': gc.spindle_speed = value; break;
+      case 'S': gc.spindle_speed = fabs(value); break;
       case 'X': case 'Y': case 'Z':
-      if (gc.absolute_mode || absolute_override) {
-        target[letter - 'X'] = unit_converted_value;
-      } else {
-        target[letter - 'X'] += unit_converted_value;
-      }
+      axis_words |= (1<<(letter - 'X'));
+      axis_value[letter - 'X'] = unit_converted_value;
       break;
     }
   }
   
   // If there were any errors parsing this line, we will return right away with the bad news
   if (gc.status_code) { return(gc.status_code); }
-    
-  // Update spindle state
-  if (gc.spindle_direction) {
-    spindle_run(gc.spindle_direction, gc.spindle_speed);
-  } else {
-    spindle_stop();
+  
+  // Axis words of motions are work coordinates (or machine coordinates with G53). Those of G10 and 
+  // G92 are the new offsets and leave target at the current position.
+  if ((next_action == NEXT_ACTION_DEFAULT) || (next_action == NEXT_ACTION_GO_HOME)) {
+    for(axis=0; axis<3; axis++) {
+      if (!(axis_words & (1<<axis))) { continue; }
+      if (absolute_override) {
+        target[axis] = axis_value[axis];
+      } else if (gc.absolute_mode) {
+        target[axis] = axis_value[axis]+gc.coord_system[axis]+gc.coord_offset[axis];
+      } else {
+        target[axis] += axis_value[axis];
+      }
+    }
+  }
+  
+  // Path control takes effect from the motion on this line on. G64 P sets the tolerance for rounding 
+  // off the corners, plain G64 uses the junction deviation setting.
+  if (path_control_mode >= 0) {
+    plan_set_path_control(path_control_mode, 
+      ((path_control_mode == PATH_CONTROL_MODE_CONTINOUS) && p_given) ? fabs(to_millimeters(p)) : -1);
+  }
+  
+  // Canned cycles keep their R, Z, Q and P words until cancelled and drill a hole on every line with axis 
+  // words. In incremental mode R is relative to the height the cycle began at and Z to the R plane.
+  // L drills the hole L times, in incremental mode each one the X and Y words on from the one before.
+  if ((gc.motion_mode >= MOTION_MODE_DRILL) && (next_action == NEXT_ACTION_DEFAULT)) {
+    uint8_t axis = gc.plane_axis_2;
+    if (l > 0) { repeats = l; }
+    if (!gc.absolute_mode) {
+      if (axis_words & (1<<gc.plane_axis_0)) { hole_step[gc.plane_axis_0] = axis_value[gc.plane_axis_0]; }
+      if (axis_words & (1<<gc.plane_axis_1)) { hole_step[gc.plane_axis_1] = axis_value[gc.plane_axis_1]; }
+    }
+    if (previous_motion_mode < MOTION_MODE_DRILL) { gc.canned_initial = gc.position[axis]; }
+    if (radius_mode) { gc.canned_r = r; }
+    if (axis_words & (1<<axis)) { gc.canned_z = axis_value[axis]; }
+    if (p_given) { gc.canned_p = p; }
+    if (gc.absolute_mode) {
+      r_plane = gc.canned_r+gc.coord_system[axis]+gc.coord_offset[axis];
+      target[axis] = gc.canned_z+gc.coord_system[axis]+gc.coord_offset[axis];
+    } else {
+      r_plane = gc.canned_initial+gc.canned_r;
+      target[axis] = r_plane+gc.canned_z;
+    }
+    retract = gc.canned_retract_to_r ? r_plane : max(gc.canned_initial, r_plane);
+    if (!axis_words) {
+      memcpy(target, gc.position, sizeof(target)); // Nothing to drill on this line
+    } else if ((target[axis] > r_plane) || gc.inverse_feed_rate_mode || (l < 0) ||
+      ((gc.motion_mode == MOTION_MODE_DRILL_PECK) && !(gc.canned_q > 0))) { // G83 needs a peck depth
+      FAIL(GCSTATUS_UNSUPPORTED_STATEMENT); 
+      return(gc.status_code); 
+    }
   }
   
+  // Refuse the whole line if the motion would end outside the machine travel
+  if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE) && (next_action == NEXT_ACTION_DEFAULT) && 
+      (gc.motion_mode != MOTION_MODE_CANCEL) && soft_limit_violation(target)) {
+    FAIL(GCSTATUS_SOFT_LIMIT_ERROR); 
+    return(gc.status_code);
+  }
+  if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE) && (next_action == NEXT_ACTION_DEFAULT) && 
+      (gc.motion_mode >= MOTION_MODE_DRILL) && axis_words) {
+    // The holes lie on a line, so checking the first and the last, bottom and top, covers them all
+    double top[3], last[3];
+    memcpy(top, target, sizeof(top));
+    top[gc.plane_axis_2] = retract;
+    for(axis=0; axis<3; axis++) { last[axis] = target[axis]+(repeats-1)*hole_step[axis]; }
+    if (soft_limit_violation(top) || soft_limit_violation(last)) { 
+      FAIL(GCSTATUS_SOFT_LIMIT_ERROR); 
+      return(gc.status_code); 
+    }
+    last[gc.plane_axis_2] = retract;
+    if (soft_limit_violation(last)) { FAIL(GCSTATUS_SOFT_LIMIT_ERROR); return(gc.status_code); }
+  }
+  
+  // Arcs can still be refused once their center is known, so they start the spindle after their checks
+  uint8_t arc_motion = (next_action == NEXT_ACTION_DEFAULT) && 
+    ((gc.motion_mode == MOTION_MODE_CW_ARC) || (gc.motion_mode == MOTION_MODE_CCW_ARC));
+  if (!arc_motion) { update_spindle(); }
+  
   // Perform any physical actions
   switch (next_action) {
-    case NEXT_ACTION_GO_HOME: mc_go_home(); break;
+    case NEXT_ACTION_GO_HOME: 
+    if (!bit_istrue(settings.flags, BITFLAG_HOMING_ENABLE)) { FAIL(GCSTATUS_UNSUPPORTED_STATEMENT); return(gc.status_code); }
+    mc_go_home(); 
+    if (st_alarm()) { FAIL(GCSTATUS_ALARM_LOCK); return(gc.status_code); }
+    clear_vector(target); // The homing cycle defines machine zero
+    break;
     case NEXT_ACTION_DWELL: mc_dwell(trunc(p*1000)); break;
+    case NEXT_ACTION_SET_COORDINATE_DATA: {
+      // G10 L2 Pn sets the offsets of coordinate system n (1 for G54), P0 those of the active one
+      if ((l != 2) || (p < 0) || (p > N_COORDINATE_SYSTEMS)) { FAIL(GCSTATUS_UNSUPPORTED_STATEMENT); return(gc.status_code); }
+      uint8_t coord_select = p ? trunc(p)-1 : gc.coord_select;
+      double coord_data[3];
+      settings_read_coord_data(coord_select, coord_data);
+      for(axis=0; axis<3; axis++) {
+        if (axis_words & (1<<axis)) { coord_data[axis] = axis_value[axis]; }
+      }
+      st_synchronize(); // Writing the EEPROM holds up the interrupts
+      settings_write_coord_data(coord_select, coord_data);
+      if (coord_select == gc.coord_select) { memcpy(gc.coord_system, coord_data, sizeof(coord_data)); }
+      break;
+    }
+    case NEXT_ACTION_SET_COORDINATE_OFFSET:
+    // Shift the work coordinates so the current position reads as the given axis words
+    for(axis=0; axis<3; axis++) {
+      if (axis_words & (1<<axis)) { 
+        gc.coord_offset[axis] = gc.position[axis]-gc.coord_system[axis]-axis_value[axis];
+      }
+    }
+    break;
+    case NEXT_ACTION_RESET_COORDINATE_OFFSET: clear_vector(gc.coord_offset); break;
     case NEXT_ACTION_DEFAULT: 
     switch (gc.motion_mode) {
       case MOTION_MODE_CANCEL: break;
+      case MOTION_MODE_DRILL: case MOTION_MODE_DRILL_DWELL: case MOTION_MODE_DRILL_PECK:
+      if (axis_words) {
+        double bottom = target[gc.plane_axis_2];
+        uint16_t hole;
+        for(hole=0; hole<repeats; hole++) {
+          if (hole) {
+            // The next hole starts from where the last one left the tool
+            memcpy(gc.position, target, sizeof(target));
+            for(axis=0; axis<3; axis++) { target[axis] += hole_step[axis]; }
+            target[gc.plane_axis_2] = bottom;
+          }
+          canned_cycle(target, r_plane, retract, (gc.motion_mode == MOTION_MODE_DRILL_PECK) ? gc.canned_q : 0,
+            (gc.motion_mode == MOTION_MODE_DRILL_DWELL) ? gc.canned_p : 0);
+        }
+      }
+      break;
       case MOTION_MODE_SEEK:
+      // Never fire the laser during rapid moves. The next line restores the power for following blocks.
+      if (bit_istrue(settings.flags, BITFLAG_LASER_MODE)) { plan_set_spindle_pwm(0); }
       mc_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], gc.seek_rate, FALSE);
       break;
       case MOTION_MODE_LINEAR:
@@ -389,6 +652,16 @@ uint8_t gc_execute_line(char *line) {
       double radius = hypot(offset[gc.plane_axis_0], offset[gc.plane_axis_1]);
       // Calculate the motion along the depth axis of the helix
       double depth = target[gc.plane_axis_2]-gc.position[gc.plane_axis_2];
+      // The arc may bulge out of the machine travel even if its end points are inside
+      if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE)) {
+        double center[2] = { gc.position[gc.plane_axis_0]+offset[gc.plane_axis_0], 
+                             gc.position[gc.plane_axis_1]+offset[gc.plane_axis_1] };
+        if (soft_limit_violation_arc(center, radius, theta_start, angular_travel)) {
+          FAIL(GCSTATUS_SOFT_LIMIT_ERROR); 
+          return(gc.status_code);
+        }
+      }
+      update_spindle();
       // Trace the arc
       mc_arc(theta_start, angular_travel, radius, depth, gc.plane_axis_0, gc.plane_axis_1, gc.plane_axis_2, 
         (gc.inverse_feed_rate_mode) ? inverse_feed_rate : gc.feed_rate, gc.inverse_feed_rate_mode,
@@ -408,6 +681,41 @@ uint8_t gc_execute_line(char *line) {
   return(gc.status_code);
 }
 
+uint8_t gc_execute_motion(uint8_t linear, uint8_t axis_words, double *axis_value, double feed_rate)
+{
+  double target[3];
+  uint8_t axis;
+  
+  // Inverse time moves need a feed word on every line and are left to G-code
+  if (linear && gc.inverse_feed_rate_mode) { return(GCSTATUS_UNSUPPORTED_STATEMENT); }
+  gc.motion_mode = linear ? MOTION_MODE_LINEAR : MOTION_MODE_SEEK;
+  if (feed_rate >= 0) {
+    if (linear) { gc.feed_rate = to_millimeters(feed_rate)/60; } else { gc.seek_rate = to_millimeters(feed_rate)/60; }
+  }
+  memcpy(target, gc.position, sizeof(target));
+  for(axis=0; axis<3; axis++) {
+    if (!(axis_words & (1<<axis))) { continue; }
+    if (gc.absolute_mode) {
+      target[axis] = to_millimeters(axis_value[axis])+gc.coord_system[axis]+gc.coord_offset[axis];
+    } else {
+      target[axis] += to_millimeters(axis_value[axis]);
+    }
+  }
+  if (bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE) && soft_limit_violation(target)) {
+    return(GCSTATUS_SOFT_LIMIT_ERROR);
+  }
+  
+  update_spindle();
+  if (linear) {
+    mc_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], gc.feed_rate, FALSE);
+  } else {
+    if (bit_istrue(settings.flags, BITFLAG_LASER_MODE)) { plan_set_spindle_pwm(0); }
+    mc_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], gc.seek_rate, FALSE);
+  }
+  memcpy(gc.position, target, sizeof(target));
+  return(GCSTATUS_OK);
+}
+
 // Parses the next statement and leaves the counter on the first character following
 // the statement. Returns 1 if there was a statements, 0 if end of string was reached
 // or there was an error (check state.status_code).
@@ -448,20 +756,18 @@ int read_double(char *line,               //!< string: line of RS274/NGC code be
 /* 
   Intentionally not supported:
 
-  - Canned cycles
+  - Canned cycles other than G81, G82 and G83
   - Tool radius compensation
   - A,B,C-axes
-  - Multiple coordinate systems
   - Evaluation of expressions
   - Variables
   - Multiple home locations
   - Probing
   - Override control
 
-   group 0 = {G10, G28, G30, G92, G92.1, G92.2, G92.3} (Non modal G-codes)
+   group 0 = {G10 other than L2, G92.3} (Non modal G-codes)
    group 8 = {M7, M8, M9} coolant (special case: M7 and M8 may be active at the same time)
    group 9 = {M48, M49} enable/disable feed and speed override switches
-   group 12 = {G54, G55, G56, G57, G58, G59, G59.1, G59.2, G59.3} coordinate system selection
-   group 13 = {G61, G61.1, G64} path control mode
+   group 12 = {G59.1, G59.2, G59.3} coordinate system selection
 */
 
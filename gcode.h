@@ -28,6 +28,10 @@
 #define GCSTATUS_EXPECTED_COMMAND_LETTER 2
 #define GCSTATUS_UNSUPPORTED_STATEMENT 3
 #define GCSTATUS_FLOATING_POINT_ERROR 4
+#define GCSTATUS_ALARM_LOCK 5
+#define GCSTATUS_SOFT_LIMIT_ERROR 6
+#define GCSTATUS_CHECKSUM_ERROR 7
+#define GCSTATUS_LINE_OVERFLOW 8
 
 // Initialize the parser
 void gc_init();
@@ -35,4 +39,9 @@ void gc_init();
 // Execute one block of rs275/ngc/g-code
 uint8_t gc_execute_line(char *line);
 
+// Execute a G0 (linear false) or G1 (linear true) received as a binary frame. The axis words flagged 
+// in axis_words and the feed rate (negative when not given) are read like the words of a G-code line 
+// in the current modal state.
+uint8_t gc_execute_motion(uint8_t linear, uint8_t axis_words, double *axis_value, double feed_rate);
+
 #endif
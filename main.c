@@ -30,6 +30,7 @@
 
 #include "settings.h"
 #include "wiring_serial.h"
+#include "profile.h"
 
 // #ifndef __AVR_ATmega328P__
 // #  error "As of version 0.6 Grbl only supports atmega328p. If you want to run Grbl on an 168 check out 0.51 ('git co v0_51')"
@@ -43,6 +44,9 @@ int main(void)
   st_init();        
   spindle_init();   
   gc_init();        
+#ifdef PROFILE
+  profile_init();
+#endif
                     
   for(;;){
     sleep_mode(); // Wait for it ...
@@ -33,7 +33,7 @@
 void mc_dwell(uint32_t milliseconds) 
 {
   st_synchronize();
-  _delay_ms(milliseconds);
+  delay_ms(milliseconds);
 }
 
 // Execute an arc. theta == start angle, angular_travel == number of radians to go along the arc,
@@ -21,6 +21,7 @@
 #ifndef nuts_bolts_h
 #define nuts_bolts_h
 #include <string.h>
+#include <inttypes.h>
 
 #define FALSE 0
 #define TRUE 1
@@ -29,7 +30,14 @@
 #define Y_AXIS 1
 #define Z_AXIS 2
 
+#define bit_istrue(x,mask) (((x) & (mask)) != 0)
+
 #define clear_vector(a) memset(a, 0, sizeof(a))
 #define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+// Delays for a number of milliseconds or microseconds given at run time
+void delay_ms(uint32_t ms);
+void delay_us(uint32_t us);
 
 #endif
@@ -62,6 +62,7 @@
 #include "settings.h"
 #include "config.h"
 #include "wiring_serial.h"
+#include "profile.h"
 
 // The number of linear motions that can be in the plan at any give time
 #ifdef __AVR_ATmega328P__
@@ -76,18 +77,27 @@ static volatile int block_buffer_tail;           // Index of the block to proces
 
 // The current position of the tool in absolute steps
 static int32_t position[3];   
+// The direction of travel and nominal speed of the last block buffered, for junction speed calculations
+static double previous_unit_vec[3];
+static double previous_nominal_speed; // Zero when the tool will be at rest before the next block
 
 static uint8_t acceleration_manager_enabled;   // Acceleration management active?
+static volatile uint8_t spindle_pwm;           // The spindle PWM duty for upcoming blocks
+static uint8_t path_control_mode;              // How upcoming blocks are joined (PATH_CONTROL_MODE_*)
+static double path_tolerance;                  // The corner tolerance of continuous mode in mm, negative for the setting
 
 #define ONE_MINUTE_OF_MICROSECONDS 60000000.0
 
 // Calculates the distance (not time) it takes to accelerate from initial_rate to target_rate using the 
-// given acceleration:
-inline double estimate_acceleration_distance(double initial_rate, double target_rate, double acceleration) {
-  return(
-    (target_rate*target_rate-initial_rate*initial_rate)/
-    (2L*acceleration)
-  );
+// given acceleration. With a jerk limit (jerk > 0) the acceleration has to ramp up and back down 
+// again, which costs an additional (initial_rate+target_rate)*acceleration/(2*jerk). This is exact when the 
+// ramp reaches full acceleration and errs on the long side for small changes of rate:
+inline double estimate_acceleration_distance(double initial_rate, double target_rate, double acceleration,
+  double jerk) 
+{
+  double distance = (target_rate*target_rate-initial_rate*initial_rate)/(2L*acceleration);
+  if (jerk > 0) { distance += (initial_rate+target_rate)*fabs(acceleration)/(2*jerk); }
+  return(distance);
 }
 
 // This function gives you the point at which you must start braking (at the rate of -acceleration) if 
@@ -112,6 +122,19 @@ inline double intersection_distance(double initial_rate, double final_rate, doub
   );
 }
 
+// The jerk limited counterpart of intersection_distance(). Returns the peak rate of a block that accelerates
+// from initial_rate and decelerates to final_rate within distance when both ramps are S-curves. Solves
+// estimate_acceleration_distance(initial_rate, peak) + estimate_acceleration_distance(peak, final_rate) == distance 
+// for the peak rate.
+inline double intersection_rate(double initial_rate, double final_rate, double acceleration, double jerk, 
+  double distance) 
+{
+  double b = acceleration*acceleration/jerk;
+  double c = (initial_rate+final_rate)*b/2-(initial_rate*initial_rate+final_rate*final_rate)/2-
+    acceleration*distance;
+  return((sqrt(b*b-4*c)-b)/2);
+}
+
 
 // Calculates trapezoid parameters so that the entry- and exit-speed is compensated by the provided factors.
 // The factors represent a factor of braking and must be in the range 0.0-1.0.
@@ -128,11 +151,14 @@ inline double intersection_distance(double initial_rate, double final_rate, doub
 void calculate_trapezoid_for_block(block_t *block, double entry_factor, double exit_factor) {
   block->initial_rate = ceil(block->nominal_rate*entry_factor);
   block->final_rate = ceil(block->nominal_rate*exit_factor);
+  block->peak_rate = block->nominal_rate;
   int32_t acceleration_per_minute = block->rate_delta*ACCELERATION_TICKS_PER_SECOND*60.0;
-  int32_t accelerate_steps = 
-    ceil(estimate_acceleration_distance(block->initial_rate, block->nominal_rate, acceleration_per_minute));
-  int32_t decelerate_steps = 
-    floor(estimate_acceleration_distance(block->nominal_rate, block->final_rate, -acceleration_per_minute));
+  double jerk_per_minute = 
+    block->jerk_delta*ACCELERATION_TICKS_PER_SECOND*ACCELERATION_TICKS_PER_SECOND*60.0*60.0;
+  int32_t accelerate_steps = ceil(estimate_acceleration_distance(block->initial_rate, block->nominal_rate, 
+    acceleration_per_minute, jerk_per_minute));
+  int32_t decelerate_steps = floor(estimate_acceleration_distance(block->nominal_rate, block->final_rate, 
+    -acceleration_per_minute, jerk_per_minute));
 
   // Calculate the size of Plateau of Nominal Rate. 
   int32_t plateau_steps = block->step_event_count-accelerate_steps-decelerate_steps;
@@ -141,8 +167,29 @@ void calculate_trapezoid_for_block(block_t *block, double entry_factor, double e
   // have to use intersection_distance() to calculate when to abort acceleration and start braking 
   // in order to reach the final_rate exactly at the end of this block.
   if (plateau_steps < 0) {  
-    accelerate_steps = ceil(
-      intersection_distance(block->initial_rate, block->final_rate, acceleration_per_minute, block->step_event_count));
+    if (block->jerk_delta) {
+      // S-curves need to know the peak rate up front to start easing off the acceleration in time
+      double peak_rate = intersection_rate(block->initial_rate, block->final_rate, acceleration_per_minute, 
+        jerk_per_minute, block->step_event_count);
+      peak_rate = max(peak_rate, max(block->initial_rate, block->final_rate));
+      block->peak_rate = min(ceil(peak_rate), block->nominal_rate);
+      // Without a change of rate there is no S-curve to round off either
+      accelerate_steps = 0;
+      if (peak_rate > block->initial_rate) {
+        accelerate_steps = ceil(estimate_acceleration_distance(block->initial_rate, peak_rate, 
+          acceleration_per_minute, jerk_per_minute));
+      }
+    } else {
+      double intersection = intersection_distance(block->initial_rate, block->final_rate, acceleration_per_minute, 
+        block->step_event_count);
+      accelerate_steps = ceil(intersection);
+      // The block turns from acceleration to deceleration at the rate reached at the intersection. The
+      // trapezoid generator takes it for the cruising rate at the turning step, so it must not be nominal_rate.
+      double peak_rate = sqrt(square(block->initial_rate)+2*acceleration_per_minute*max(intersection, 0));
+      peak_rate = max(peak_rate, max(block->initial_rate, block->final_rate));
+      block->peak_rate = min(ceil(peak_rate), block->nominal_rate);
+    }
+    accelerate_steps = max(0,min(accelerate_steps, block->step_event_count));
     plateau_steps = 0;
   }  
   
@@ -152,21 +199,49 @@ void calculate_trapezoid_for_block(block_t *block, double entry_factor, double e
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the 
 // acceleration within the allotted distance.
+// With a jerk limit in effect the S-curve distance of estimate_acceleration_distance() is solved for the
+// initial speed instead.
 inline double max_allowable_speed(double acceleration, double target_velocity, double distance) {
+  if (settings.jerk > 0) {
+    double b = acceleration*acceleration*60/settings.jerk; // (acceleration*60*60)^2/(jerk*60*60*60)
+    double c = target_velocity*b-target_velocity*target_velocity+2*acceleration*60*60*distance;
+    return((sqrt(b*b-4*c)-b)/2);
+  }
   return(
     sqrt(target_velocity*target_velocity-2*acceleration*60*60*distance)
   );
 }
 
-// "Junction jerk" in this context is the immediate change in speed at the junction of two blocks.
-// This method will calculate the junction jerk as the euclidean distance between the nominal 
-// velocities of the respective blocks.
-inline double junction_jerk(block_t *before, block_t *after) {
-  return(sqrt(
-    pow(before->speed_x-after->speed_x, 2)+
-    pow(before->speed_y-after->speed_y, 2)+
-    pow(before->speed_z-after->speed_z, 2))
-  );
+// Computes the maximum speed at which the tool may pass the junction between two blocks. The junction 
+// deviation model pretends the tool rounds the corner along a circle that stays within 
+// settings.junction_deviation of the sharp corner, and limits the speed to what the acceleration 
+// allows on that circle:
+//
+//    R = junction_deviation * sin(theta/2)/(1-sin(theta/2))
+//    v_max = sqrt(acceleration * R)
+//
+// where theta is the angle between the two directions of travel. Straight junctions go at full 
+// speed, shallow corners go fast, sharp corners and reversals go slow.
+double junction_speed(double *previous_unit_vec, double previous_nominal_speed, double *unit_vec, 
+  double nominal_speed, double acceleration, double junction_deviation) 
+{
+  // The speed at which the tool may always start and stop (see factor_for_safe_speed())
+  double safe_speed = min(settings.max_jerk, nominal_speed);
+  // cos(theta) of the angle between the directions of travel, where theta == PI is straight on
+  double cos_theta = - previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
+                     - previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
+                     - previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS];
+  if (cos_theta > 0.95) { return(safe_speed); } // Close to a reversal
+  // Without any deviation allowed (G61) only a straight continuation keeps its speed. The shortcut for
+  // shallow corners below would let those pass at full speed.
+  if ((junction_deviation == 0.0) && (cos_theta > -0.999999)) { return(safe_speed); }
+  double vmax_junction = min(previous_nominal_speed, nominal_speed);
+  if (cos_theta > -0.95) { // Not close to straight on
+    double sin_theta_d2 = sqrt(0.5*(1.0-cos_theta)); // Trig half angle identity. Always positive.
+    vmax_junction = min(vmax_junction, 
+      sqrt(acceleration*60*60 * junction_deviation * sin_theta_d2/(1.0-sin_theta_d2)));
+  }
+  return(max(vmax_junction, safe_speed));
 }
 
 // Calculate a braking factor to reach baseline speed which is max_jerk/2, e.g. the 
@@ -189,14 +264,13 @@ void planner_reverse_pass_kernel(block_t *previous, block_t *current, block_t *n
   
   // Calculate the entry_factor for the current block. 
   if (previous) {
-    // Reduce speed so that junction_jerk is within the maximum allowed
-    double jerk = junction_jerk(previous, current);
-    if (jerk > settings.max_jerk) {
-      entry_factor = (settings.max_jerk/jerk);
+    // Reduce speed to what the junction with the previous block allows
+    if (current->max_entry_speed < current->nominal_speed) {
+      entry_factor = current->max_entry_speed/current->nominal_speed;
     } 
     // If the required deceleration across the block is too rapid, reduce the entry_factor accordingly.
     if (entry_factor > exit_factor) {
-      double max_entry_speed = max_allowable_speed(-settings.acceleration,current->nominal_speed*exit_factor, 
+      double max_entry_speed = max_allowable_speed(-current->acceleration,current->nominal_speed*exit_factor, 
         current->millimeters);
       double max_entry_factor = max_entry_speed/current->nominal_speed;
       if (max_entry_factor < entry_factor) {
@@ -226,7 +300,8 @@ void planner_reverse_pass() {
     block[0] = &block_buffer[block_index];
     planner_reverse_pass_kernel(block[0], block[1], block[2]);
   }
-  planner_reverse_pass_kernel(NULL, block[0], block[1]);
+  // The first block is left alone. It is either being executed or about to start from rest, as
+  // plan_buffer_line() planned it.
 }
 
 // The kernel called by planner_recalculate() when scanning the plan from first to last entry.
@@ -238,7 +313,7 @@ void planner_forward_pass_kernel(block_t *previous, block_t *current, block_t *n
     // speed accordingly. Remember current->entry_factor equals the exit factor of 
     // the previous block.
     if(previous->entry_factor < current->entry_factor) {
-      double max_entry_speed = max_allowable_speed(-settings.acceleration,
+      double max_entry_speed = max_allowable_speed(-previous->acceleration,
         current->nominal_speed*previous->entry_factor, previous->millimeters);
       double max_entry_factor = max_entry_speed/current->nominal_speed;
       if (max_entry_factor < current->entry_factor) {
@@ -287,7 +362,7 @@ void planner_recalculate_trapezoids() {
 //
 //   1. Go over every block in reverse order and calculate a junction speed reduction (i.e. block_t.entry_factor) 
 //      so that:
-//     a. The junction jerk is within the set limit
+//     a. The junction speed is within block_t.max_entry_speed
 //     b. No speed reduction within one block requires faster deceleration than the one, true constant 
 //        acceleration.
 //   2. Go over every block in chronological order and dial down junction speed reduction values if 
@@ -295,15 +370,21 @@ void planner_recalculate_trapezoids() {
 //        constant acceleration.
 //
 // When these stages are complete all blocks have an entry_factor that will allow all speed changes to 
-// be performed using only the one, true constant acceleration, and where no junction jerk is jerkier than 
-// the set limit. Finally it will:
+// be performed using only the one, true constant acceleration of each block, and where no junction is
+// passed faster than the junction deviation allows. Finally it will:
 //
 //   3. Recalculate trapezoids for all blocks.
 
 void planner_recalculate() {     
+#ifdef PROFILE
+  uint32_t profile_start = profile_time();
+#endif
   planner_reverse_pass();
   planner_forward_pass();
   planner_recalculate_trapezoids();
+#ifdef PROFILE
+  profile_add(PROFILE_RECALCULATE, profile_start);
+#endif
 }
 
 void plan_init() {
@@ -311,6 +392,15 @@ void plan_init() {
   block_buffer_tail = 0;
   plan_set_acceleration_manager_enabled(TRUE);
   clear_vector(position);
+  clear_vector(previous_unit_vec);
+  previous_nominal_speed = 0.0;
+  spindle_pwm = 0;
+  plan_set_path_control(PATH_CONTROL_MODE_CONTINOUS, -1);
+}
+
+void plan_set_path_control(uint8_t mode, double tolerance) {
+  path_control_mode = mode;
+  path_tolerance = tolerance;
 }
 
 void plan_set_acceleration_manager_enabled(int enabled) {
@@ -324,6 +414,25 @@ int plan_is_acceleration_manager_enabled() {
   return(acceleration_manager_enabled);
 }
 
+void plan_set_spindle_pwm(uint8_t pwm) {
+  spindle_pwm = pwm;
+}
+
+uint8_t plan_get_spindle_pwm() {
+  return(spindle_pwm);
+}
+
+void plan_set_current_position(double x, double y, double z) {
+  position[X_AXIS] = lround(x*settings.steps_per_mm[X_AXIS]);
+  position[Y_AXIS] = lround(y*settings.steps_per_mm[Y_AXIS]);
+  position[Z_AXIS] = lround(z*settings.steps_per_mm[Z_AXIS]);
+  previous_nominal_speed = 0.0; // The tool is at rest
+}
+
+void plan_flush() {
+  block_buffer_tail = block_buffer_head;
+}
+
 inline void plan_discard_current_block() {
   if (block_buffer_head != block_buffer_tail) {
     block_buffer_tail = (block_buffer_tail + 1) % BLOCK_BUFFER_SIZE;  
@@ -349,9 +458,22 @@ void plan_buffer_line(double x, double y, double z, double feed_rate, int invert
   
   // Calculate the buffer head after we push this byte
 	int next_buffer_head = (block_buffer_head + 1) % BLOCK_BUFFER_SIZE;	
+#ifdef PROFILE
+  profile_buffer_fill((block_buffer_head-block_buffer_tail+BLOCK_BUFFER_SIZE) % BLOCK_BUFFER_SIZE);
+  uint32_t profile_start = profile_time();
+  uint8_t buffer_full = (block_buffer_tail == next_buffer_head);
+#endif
 	// If the buffer is full: good! That means we are well ahead of the robot. 
 	// Rest here until there is room in the buffer.
   while(block_buffer_tail == next_buffer_head) { sleep_mode(); }
+#ifdef PROFILE
+  if (buffer_full) { 
+    profile_add(PROFILE_WAIT, profile_start); 
+    profile_start = profile_time();
+  }
+#endif
+  // Motion was aborted by a hard limit. Don't queue anything until reset.
+  if (st_alarm()) { return; }
   // Prepare to set up new block
   block_t *block = &block_buffer[block_buffer_head];
   // Number of steps for each axis
@@ -377,12 +499,45 @@ void plan_buffer_line(double x, double y, double z, double feed_rate, int invert
   
   // Calculate speed in mm/minute for each axis
   double multiplier = 60.0*1000000.0/microseconds;
-  block->speed_x = delta_x_mm * multiplier;
-  block->speed_y = delta_y_mm * multiplier;
-  block->speed_z = delta_z_mm * multiplier; 
+  // Slow the whole block down if that is what it takes to keep every axis within its maximum rate
+  double delta_mm[3] = {delta_x_mm, delta_y_mm, delta_z_mm};
+  // The path acceleration ($8) still caps the axis accelerations. Raising $24-$26 beyond it takes a
+  // higher $8 as well.
+  double acceleration = settings.acceleration;
+  uint8_t axis;
+  for(axis=0; axis<3; axis++) {
+    if (delta_mm[axis] == 0) { continue; }
+    double axis_speed = fabs(delta_mm[axis])*multiplier;
+    if (axis_speed > settings.max_rate[axis]) { multiplier *= settings.max_rate[axis]/axis_speed; }
+    // The path acceleration at which this axis reaches its own acceleration limit. (The axis
+    // accelerates by the fraction of the path acceleration its share of the travel represents.)
+    double axis_limited_acceleration = settings.axis_acceleration[axis]*block->millimeters/fabs(delta_mm[axis]);
+    if (axis_limited_acceleration < acceleration) { acceleration = axis_limited_acceleration; }
+  }
+  block->acceleration = acceleration;
   block->nominal_speed = block->millimeters * multiplier;
   block->nominal_rate = ceil(block->step_event_count * multiplier);  
-  block->entry_factor = 0.0;
+  block->entry_factor = factor_for_safe_speed(block); // From rest, unless the reverse pass finds better
+  block->spindle_pwm = spindle_pwm;
+  
+  // Limit the speed at the junction with the previous block. A block following a stop starts from rest, 
+  // and so does every block in exact stop mode. Exact path mode allows no deviation from the corner.
+  double unit_vec[3] = {delta_x_mm/block->millimeters, delta_y_mm/block->millimeters, 
+    delta_z_mm/block->millimeters};
+  if ((block_buffer_head != block_buffer_tail) && (previous_nominal_speed > 0.0) && 
+      (path_control_mode != PATH_CONTROL_MODE_EXACT_STOP)) {
+    block_t *previous = &block_buffer[(block_buffer_head+BLOCK_BUFFER_SIZE-1) % BLOCK_BUFFER_SIZE];
+    double junction_deviation = 0.0;
+    if (path_control_mode == PATH_CONTROL_MODE_CONTINOUS) {
+      junction_deviation = (path_tolerance < 0) ? settings.junction_deviation : path_tolerance;
+    }
+    block->max_entry_speed = junction_speed(previous_unit_vec, previous_nominal_speed, unit_vec, 
+      block->nominal_speed, min(previous->acceleration, block->acceleration), junction_deviation);
+  } else {
+    block->max_entry_speed = min(settings.max_jerk, block->nominal_speed);
+  }
+  memcpy(previous_unit_vec, unit_vec, sizeof(unit_vec)); // previous_unit_vec[] = unit_vec[]
+  previous_nominal_speed = block->nominal_speed;
   
   // Compute the acceleration rate for the trapezoid generator. Depending on the slope of the line
   // average travel per step event changes. For a line along one axis the travel per step event
@@ -392,8 +547,15 @@ void plan_buffer_line(double x, double y, double z, double feed_rate, int invert
   // specifically for each line to compensate for this phenomenon:
   double travel_per_step = block->millimeters/block->step_event_count;
   block->rate_delta = ceil(
-    ((settings.acceleration*60.0)/(ACCELERATION_TICKS_PER_SECOND))/ // acceleration mm/sec/sec per acceleration_tick
-    travel_per_step);                                               // convert to: acceleration steps/min/acceleration_tick    
+    ((block->acceleration*60.0)/(ACCELERATION_TICKS_PER_SECOND))/ // acceleration mm/sec/sec per acceleration_tick
+    travel_per_step);                                             // convert to: acceleration steps/min/acceleration_tick    
+  // The same goes for the jerk limit, which is the change of rate_delta per acceleration_tick
+  block->jerk_delta = 0;
+  if (settings.jerk > 0) {
+    block->jerk_delta = ceil(
+      ((settings.jerk*60.0)/(ACCELERATION_TICKS_PER_SECOND*ACCELERATION_TICKS_PER_SECOND))/ // jerk mm/sec^3 per acceleration_tick^2
+      travel_per_step);                                                                       // convert to: steps/min/acceleration_tick^2
+  }
   if (acceleration_manager_enabled) {
     // compute a preliminary conservative acceleration trapezoid
     double safe_speed_factor = factor_for_safe_speed(block);
@@ -403,7 +565,9 @@ void plan_buffer_line(double x, double y, double z, double feed_rate, int invert
     block->final_rate = block->nominal_rate;
     block->accelerate_until = 0;
     block->decelerate_after = block->step_event_count;
+    block->peak_rate = block->nominal_rate;
     block->rate_delta = 0;
+    block->jerk_delta = 0;
   }
   
   // Compute direction bits for this block
@@ -418,6 +582,9 @@ void plan_buffer_line(double x, double y, double z, double feed_rate, int invert
   memcpy(position, target, sizeof(target)); // position[] = target[]
   
   if (acceleration_manager_enabled) { planner_recalculate(); }  
+#ifdef PROFILE
+  profile_add(PROFILE_PLAN, profile_start);
+#endif
   st_wake_up();
 }
 
@@ -36,9 +36,10 @@ typedef struct {
   uint32_t nominal_rate;              // The nominal step rate for this block in step_events/minute
   
   // Fields used by the motion planner to manage acceleration
-  double speed_x, speed_y, speed_z;   // Nominal mm/minute for each axis
   double nominal_speed;               // The nominal speed for this block in mm/min  
   double millimeters;                 // The total travel of this block in mm
+  double acceleration;                // The acceleration along the path in mm/sec^2, within every axis limit
+  double max_entry_speed;             // The maximum speed in mm/min at the junction with the previous block
   double entry_factor;                // The factor representing the change in speed at the start of this trapezoid.
                                       // (The end of the curren speed trapezoid is defined by the entry_factor of the
                                       // next block)
@@ -47,8 +48,13 @@ typedef struct {
   uint32_t initial_rate;              // The jerk-adjusted step rate at start of block  
   uint32_t final_rate;                // The minimal rate at exit
   int32_t rate_delta;                 // The steps/minute to add or subtract when changing speed (must be positive)
+  int32_t jerk_delta;                 // The change of rate_delta per acceleration tick on S-curves. Zero for trapezoids.
+  uint32_t peak_rate;                 // The highest rate of this block. The nominal_rate unless the block is too 
+                                      // short to get there.
   uint32_t accelerate_until;          // The index of the step event on which to stop acceleration
   uint32_t decelerate_after;          // The index of the step event on which to start decelerating
+
+  uint8_t spindle_pwm;                // The spindle PWM duty to apply when this block starts
   
 } block_t;
       
@@ -60,6 +66,13 @@ void plan_init();
 // rate is taken to mean "frequency" and would complete the operation in 1/feed_rate minutes.
 void plan_buffer_line(double x, double y, double z, double feed_rate, int invert_feed_rate);
 
+// Reset the planner position vector to the given absolute position in millimeters. Must only be called
+// when the buffer is empty, e.g. after the homing cycle.
+void plan_set_current_position(double x, double y, double z);
+
+// Discards every block in the buffer. Called by the stepper when motion is aborted.
+void plan_flush();
+
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // availible for new blocks.
 inline void plan_discard_current_block();
@@ -73,4 +86,19 @@ void plan_set_acceleration_manager_enabled(int enabled);
 // Is acceleration-management currently enabled?
 int plan_is_acceleration_manager_enabled();
 
+// Sets the spindle PWM duty for upcoming blocks, so speed changes are executed in sync with the motion
+void plan_set_spindle_pwm(uint8_t pwm);
+
+// The spindle PWM duty that will be given to the next block
+uint8_t plan_get_spindle_pwm();
+
+#define PATH_CONTROL_MODE_EXACT_PATH 0 // G61
+#define PATH_CONTROL_MODE_EXACT_STOP 1 // G61.1
+#define PATH_CONTROL_MODE_CONTINOUS  2 // G64
+
+// Sets how upcoming blocks are joined. In continuous mode corners are rounded off within tolerance mm 
+// of the programmed corner, or within settings.junction_deviation if tolerance is negative. Exact path 
+// mode slows down to the safe speed in every corner, exact stop mode at every junction.
+void plan_set_path_control(uint8_t mode, double tolerance);
+
 #endif
\ No newline at end of file
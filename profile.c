@@ -0,0 +1,120 @@
+/*
+  profile.c - counts where the time goes between the serial port and the steppers
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <math.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "stepper.h"
+#include "wiring_serial.h"
+#include "nuts_bolts.h"
+
+#define CYCLES_PER_PROFILE_COUNT 64 // Timer 2 runs at the 1/64 prescaler
+
+volatile uint32_t profile_timer2_overflows;
+
+static uint32_t started;                          // The profile_time() of the last reset
+static uint32_t section_time[PROFILE_SECTIONS];   // Timer 2 counts spent in each section
+static uint32_t section_calls[PROFILE_SECTIONS];
+static uint8_t min_fill;
+static uint32_t fill_sum;
+static uint32_t fill_samples;
+static volatile uint16_t underruns;
+static volatile uint8_t executing_line;
+
+void profile_init() {
+  memset(section_time, 0, sizeof(section_time));
+  memset(section_calls, 0, sizeof(section_calls));
+  min_fill = 0xff;
+  fill_sum = 0;
+  fill_samples = 0;
+  cli();
+  underruns = 0;
+  sei();
+  started = profile_time();
+}
+
+uint32_t profile_time() {
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t overflows = profile_timer2_overflows;
+  uint8_t count = TCNT2;
+  // Timer 2 runs in fast PWM mode, which sets TOV2 at MAX rather than on the wrap to 0. Counting the
+  // overflow at 255 makes count+1 run on from it, and an overflow still pending while interrupts
+  // were off belongs to the time read whatever the count.
+  if (TIFR2 & (1<<TOV2)) { overflows++; }
+  SREG = sreg;
+  return((overflows << 8) + (uint8_t)(count+1));
+}
+
+void profile_add(uint8_t section, uint32_t start) {
+  section_time[section] += profile_time()-start;
+  section_calls[section]++;
+}
+
+void profile_executing(uint8_t executing) {
+  executing_line = executing;
+}
+
+void profile_buffer_fill(uint8_t blocks) {
+  if (blocks < min_fill) { min_fill = blocks; }
+  fill_sum += blocks;
+  fill_samples++;
+}
+
+void profile_starved() {
+  if (executing_line || serialAvailable()) { underruns++; }
+}
+
+// Prints the average cycles per call of the section and the share of the time it took
+static void print_section(uint8_t section) {
+  printInteger(section_calls[section]);
+  printPgmString(PSTR(" calls, "));
+  printInteger(section_calls[section] ?
+    lround((double)section_time[section]*CYCLES_PER_PROFILE_COUNT/section_calls[section]) : 0);
+  printPgmString(PSTR(" cycles/call, "));
+  printInteger(lround(100.0*section_time[section]/max(profile_time()-started, 1)));
+  printPgmString(PSTR("% of the time\r\n"));
+}
+
+void profile_report() {
+  double seconds = (double)max(profile_time()-started, 1)*CYCLES_PER_PROFILE_COUNT/F_CPU;
+  uint16_t fill_tenths = fill_samples ? lround(10.0*fill_sum/fill_samples) : 0;
+  printPgmString(PSTR("Profile of the last ")); printInteger(lround(seconds*1000));
+  printPgmString(PSTR(" ms\r\ngc_execute_line: ")); print_section(PROFILE_LINE);
+  printPgmString(PSTR("plan_buffer_line: ")); print_section(PROFILE_PLAN);
+  printPgmString(PSTR("planner_recalculate: ")); print_section(PROFILE_RECALCULATE);
+  printPgmString(PSTR("Waiting for the buffer: ")); print_section(PROFILE_WAIT);
+  printPgmString(PSTR("Lines/s: ")); printInteger(lround(section_calls[PROFILE_LINE]/seconds));
+  printPgmString(PSTR(", blocks planned/s: ")); printInteger(lround(section_calls[PROFILE_PLAN]/seconds));
+  printPgmString(PSTR("\r\nBlock buffer fill: min ")); printInteger(fill_samples ? min_fill : 0);
+  printPgmString(PSTR(", avg ")); printInteger(fill_tenths/10);
+  printByte('.'); printInteger(fill_tenths%10);
+  printPgmString(PSTR("\r\nUnderruns: ")); printInteger(underruns);
+  printPgmString(PSTR(", step overruns since power up: ")); printInteger(st_overruns());
+  printPgmString(PSTR("\r\n"));
+  profile_init();
+}
+
+#endif
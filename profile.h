@@ -0,0 +1,70 @@
+/*
+  profile.h - counts where the time goes between the serial port and the steppers
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Only built with PROFILE defined in config.h. Times the parser and the planner by the free running
+   timer 2 (64 cycles resolution, interrupts included), samples the fill of the block buffer and counts
+   the underruns. '$P' prints the counters and starts over, so send it before and after a job.
+
+   Many waits for room in the block buffer mean the planner is ahead of the steppers and the job runs
+   at the programmed feed. Underruns with few waits mean the steppers are starved: by the serial link
+   when the time spent executing lines is small, by the parser and the planner when it is large. */
+
+#ifndef profile_h
+#define profile_h
+
+#include "config.h"
+
+#ifdef PROFILE
+
+#include <avr/io.h>
+
+// The timed sections
+#define PROFILE_LINE 0        // gc_execute_line() and binary frames, planning and waiting included
+#define PROFILE_PLAN 1        // plan_buffer_line() without the wait for room, planner_recalculate() included
+#define PROFILE_RECALCULATE 2 // planner_recalculate()
+#define PROFILE_WAIT 3        // plan_buffer_line() waiting for room in the block buffer
+#define PROFILE_SECTIONS 4
+
+// Counted up by the overflow interrupt of timer 2
+extern volatile uint32_t profile_timer2_overflows;
+
+void profile_init();
+
+// The time since power up in timer 2 counts (64 cycles each)
+uint32_t profile_time();
+
+// Adds the time since start (a profile_time()) to the section and counts a call of it
+void profile_add(uint8_t section, uint32_t start);
+
+// Tells whether a line is being executed. The buffer running empty meanwhile is an underrun.
+void profile_executing(uint8_t executing);
+
+// Samples the number of blocks in the buffer when a new one is about to be planned
+void profile_buffer_fill(uint8_t blocks);
+
+// Called by the stepper when it runs out of blocks without having been asked to stop
+void profile_starved();
+
+// Prints the counters collected since the last report and resets them
+void profile_report();
+
+#endif
+
+#endif
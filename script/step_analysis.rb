@@ -0,0 +1,247 @@
+require 'rubygems'
+require 'optparse'
+
+# Compares a trace of the step and direction pins with the blocks Grbl planned for the same program
+# and reports how far the real step timing is from the ideal velocity profile.
+#
+# The trace is the CSV sim/avr_trace writes ("cycle,signal,level" after a "# f_cpu" line). The blocks
+# are the CSV sim/grbl_sim -p writes for the same G-code, settings and baud rate. The ideal profile of
+# a block accelerates at rate_delta per acceleration tick from initial_rate to peak_rate until
+# accelerate_until, cruises, and decelerates to final_rate from decelerate_after. The Bresenham
+# tracer of stepper.c is replayed to know which axes step on each step event. Each block is aligned
+# on its first step, so the errors are those that build up inside the block.
+
+$options = {
+  :config => File.join(File.dirname(__FILE__), '..', 'config.h'),
+  :invert_mask => 0,
+  :bucket => 4.0,
+  :group_cycles => 8,
+}
+
+options_parser = OptionParser.new do |opts|
+  opts.banner = "Usage: step_analysis [options] trace.csv blocks.csv"
+  opts.on('-c', '--config FILE', 'config.h the firmware was built with (for the pins and the tick rate)') do |file|
+    $options[:config] = file
+  end
+  opts.on('-i', '--invert-mask MASK', Integer, 'The step/direction invert mask setting ($8)') do |mask|
+    $options[:invert_mask] = mask
+  end
+  opts.on('-b', '--bucket MICROSECONDS', Float, "Width of the jitter histogram buckets (default #{$options[:bucket]})") do |width|
+    $options[:bucket] = width
+  end
+  opts.on('-h', '--help', 'Display this screen') do
+    puts opts
+    exit
+  end
+end
+options_parser.parse!
+if ARGV.size != 2
+  puts options_parser
+  exit 1
+end
+
+AXES = %w(X Y Z)
+
+config = File.read($options[:config])
+define = lambda { |name| config[/^\s*#define\s+#{name}\s+(\d+)/, 1].to_i }
+STEP_BITS = AXES.map { |axis| define.call("#{axis}_STEP_BIT") }
+DIRECTION_BITS = AXES.map { |axis| define.call("#{axis}_DIRECTION_BIT") }
+ACCELERATION_TICKS_PER_SECOND = define.call('ACCELERATION_TICKS_PER_SECOND')
+
+# The steps of the trace: [cycle, axis mask, direction levels] for each step event
+def read_trace(file)
+  f_cpu = nil
+  events = []
+  direction = [0, 0, 0]
+  File.foreach(file) do |line|
+    if line =~ /^# f_cpu (\d+)/
+      f_cpu = $1.to_f
+      next
+    end
+    cycle, signal, level = line.strip.split(',')
+    next unless signal =~ /^([XYZ])_(STEP|DIR)$/
+    axis = AXES.index($1)
+    bit = ($2 == 'STEP') ? STEP_BITS[axis] : DIRECTION_BITS[axis]
+    level = level.to_i ^ (($options[:invert_mask] >> bit) & 1)
+    if $2 == 'DIR'
+      direction[axis] = level
+    elsif level == 1
+      cycle = cycle.to_i
+      if events.last && cycle-events.last[0] <= $options[:group_cycles]
+        events.last[1] |= 1 << axis
+      else
+        events << [cycle, 1 << axis, direction.dup]
+      end
+    end
+  end
+  raise "#{file} has no '# f_cpu' line" unless f_cpu
+  [f_cpu, events.map { |cycle, mask, levels| [cycle/f_cpu, mask, levels] }]
+end
+
+def read_blocks(file)
+  lines = File.readlines(file)
+  columns = lines.shift.strip.split(',')
+  lines.map { |line| Hash[columns.zip(line.strip.split(',').map { |value| value.to_f })] }
+end
+
+# The ideal time (seconds from the first step) and speed (steps/second) of step s of the block
+class Profile
+  def initialize(block)
+    @v0 = block['initial_rate']/60
+    @vp = block['peak_rate']/60
+    @vf = block['final_rate']/60
+    @a = block['rate_delta']*ACCELERATION_TICKS_PER_SECOND/60
+    @na = [block['accelerate_until'], block['decelerate_after']].min
+    @nd = block['decelerate_after']
+  end
+
+  def time(s)
+    t = 0.0
+    accelerating = [s, @na].min
+    reached = (@a > 0) ? [(@vp**2-@v0**2)/(2*@a), 0].max : 0
+    ramp = [accelerating, reached].min
+    t += (Math.sqrt(@v0**2+2*@a*ramp)-@v0)/@a if @a > 0
+    t += (accelerating-ramp)/@vp
+    cruising = [s, @nd].min-@na
+    t += cruising/@vp if cruising > 0
+    decelerating = s-@nd
+    if decelerating > 0
+      floor = (@a > 0) ? [(@vp**2-@vf**2)/(2*@a), 0].max : 0
+      ramp = [decelerating, floor].min
+      t += (@vp-Math.sqrt([@vp**2-2*@a*ramp, 0].max))/@a if @a > 0
+      t += (decelerating-ramp)/[@vf, 1e-9].max
+    end
+    t
+  end
+
+  def phase(s)
+    (s < @na) ? :accelerating : ((s < @nd) ? :cruising : :decelerating)
+  end
+end
+
+# The axes stepping on each step event of the block, as the Bresenham tracer in stepper.c has them
+def bresenham(block)
+  count = block['step_event_count'].to_i
+  steps = AXES.map { |axis| block["steps_#{axis.downcase}"].to_i }
+  counters = [-(count >> 1)]*3
+  (0...count).map do
+    mask = 0
+    3.times do |axis|
+      counters[axis] += steps[axis]
+      if counters[axis] > 0
+        mask |= 1 << axis
+        counters[axis] -= count
+      end
+    end
+    mask
+  end
+end
+
+class Histogram
+  def initialize(width)
+    @width = width
+    @counts = Hash.new(0)
+    @values = []
+  end
+
+  def <<(value)
+    @counts[(value/@width).floor] += 1
+    @values << value
+  end
+
+  def empty?
+    @values.empty?
+  end
+
+  def summary
+    rms = Math.sqrt(@values.inject(0.0) { |sum, value| sum+value**2 }/@values.size)
+    "%d samples, rms %.2f, min %.2f, max %.2f" % [@values.size, rms, @values.min, @values.max]
+  end
+
+  def print(indent)
+    most = @counts.values.max
+    @counts.keys.sort.each do |bucket|
+      bar = '#'*(50.0*@counts[bucket]/most).ceil
+      puts "#{indent}%8.1f .. %8.1f %8d %s" % [bucket*@width, (bucket+1)*@width, @counts[bucket], bar]
+    end
+  end
+end
+
+f_cpu, events = read_trace(ARGV[0])
+blocks = read_blocks(ARGV[1])
+
+jitter = AXES.map { Histogram.new($options[:bucket]) } # Step interval error per axis in microseconds
+velocity = Hash.new { |hash, phase| hash[phase] = Histogram.new(1.0) } # Speed error in percent per phase
+block_end_error = Histogram.new(0.1)                  # Timing error at the last step of each block in ms
+missed = [0, 0, 0]
+extra = [0, 0, 0]
+wrong_direction = [0, 0, 0]
+
+index = 0
+blocks.each do |block|
+  profile = Profile.new(block)
+  masks = bresenham(block)
+  break if index >= events.size
+  start = events[index][0]-profile.time(0)
+  last_step = [nil, nil, nil]
+  s = 0
+  while s < masks.size && index < events.size
+    time, actual, levels = events[index]
+    if actual != masks[s]
+      # A whole step event missing or added shows as the trace running one event ahead or behind
+      if s+1 < masks.size && actual == masks[s+1] && masks[s] != masks[s+1]
+        3.times { |axis| missed[axis] += masks[s][axis] }
+        s += 1
+        next
+      elsif index+1 < events.size && events[index+1][1] == masks[s]
+        3.times { |axis| extra[axis] += actual[axis] }
+        index += 1
+        next
+      end
+    end
+    3.times do |axis|
+      expected = masks[s][axis] == 1
+      stepped = actual[axis] == 1
+      missed[axis] += 1 if expected && !stepped
+      extra[axis] += 1 if stepped && !expected
+      next unless expected && stepped
+      wrong_direction[axis] += 1 if levels[axis] != (block['direction_bits'].to_i >> DIRECTION_BITS[axis]) & 1
+      if last_step[axis]
+        previous_s, previous_time = last_step[axis]
+        ideal = profile.time(s)-profile.time(previous_s)
+        jitter[axis] << ((time-previous_time)-ideal)*1e6
+      end
+      last_step[axis] = [s, time]
+    end
+    if s > 0
+      ideal_interval = profile.time(s)-profile.time(s-1)
+      actual_interval = time-events[index-1][0]
+      velocity[profile.phase(s)] << 100.0*(ideal_interval/actual_interval-1) if actual_interval > 0
+    end
+    s += 1
+    index += 1
+  end
+  block_end_error << (events[index-1][0]-start-profile.time(s-1))*1e3 if s == masks.size
+end
+
+planned = blocks.inject(0) { |sum, block| sum+block['step_event_count'].to_i }
+puts "#{events.size} step events in the trace, #{planned} planned in #{blocks.size} blocks"
+puts "The trace has #{planned-events.size} fewer step events than the plan" if events.size < planned
+puts
+puts "Step interval error (actual - ideal, microseconds):"
+AXES.each_with_index do |axis, i|
+  next if jitter[i].empty?
+  puts "  #{axis}: #{jitter[i].summary}"
+  jitter[i].print('    ')
+end
+puts
+puts "Speed error (percent, positive is too fast):"
+[:accelerating, :cruising, :decelerating].each do |phase|
+  puts "  %-13s %s" % [phase, velocity[phase].summary] unless velocity[phase].empty?
+end
+puts "  Block duration error (ms): #{block_end_error.summary}" unless block_end_error.empty?
+puts
+puts "Missed steps:    " + AXES.each_with_index.map { |axis, i| "#{axis} #{missed[i]}" }.join(', ')
+puts "Extra steps:     " + AXES.each_with_index.map { |axis, i| "#{axis} #{extra[i]}" }.join(', ')
+puts "Wrong direction: " + AXES.each_with_index.map { |axis, i| "#{axis} #{wrong_direction[i]}" }.join(', ')
+exit((missed+extra+wrong_direction).inject(:+) > 0 ? 1 : 0)
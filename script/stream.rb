@@ -1,18 +1,47 @@
 require 'rubygems'
 require 'optparse'
 require 'serialport'
+require 'thread'
 
+# Streams G-code files to Grbl and reports how well the link kept up.
+#
+# By default every line waits for its 'ok'. With --pipeline the tool keeps as many lines in flight
+# as fit in the receive buffer of the firmware, counting the characters of every line that is not
+# acknowledged yet, so the parser always has the next line at hand without overrunning the buffer.
+
+$options = {
+  :port => ENV['GRBL_PORT'] || '/dev/tty.usbserial-A700e0GO',
+  :baud => 9600,
+  :rx_buffer_size => 255, # RX_BUFFER_SIZE in wiring_serial.c holds one byte less than its size
+  :pipeline => false,
+  :binary => false,
+  :stop_on_error => false,
+  :verbose => false,
+}
 
 options_parser = OptionParser.new do |opts|
-  opts.banner = "Usage: stream [options] gcode-file"
-  opts.on('-v', '--verbose', 'Output more information') do
-    $verbose = true
-  end   
-
-  opts.on('-p', '--prebuffer', 'Prebuffer commands') do
-    $prebuffer = true
-  end   
-  
+  opts.banner = "Usage: stream [options] gcode-file ..."
+  opts.on('-P', '--port PORT', "Serial port (default #{$options[:port]}, or set GRBL_PORT)") do |port|
+    $options[:port] = port
+  end
+  opts.on('-B', '--baud RATE', Integer, "Baud rate (default #{$options[:baud]})") do |baud|
+    $options[:baud] = baud
+  end
+  opts.on('-p', '--pipeline', 'Keep the receive buffer of the firmware filled instead of waiting for each ok') do
+    $options[:pipeline] = true
+  end
+  opts.on('-r', '--rx-buffer BYTES', Integer, "Receive buffer size for --pipeline (default #{$options[:rx_buffer_size]})") do |size|
+    $options[:rx_buffer_size] = size
+  end
+  opts.on('-b', '--binary', 'Send G0 and G1 lines as binary motion frames') do
+    $options[:binary] = true
+  end
+  opts.on('-e', '--stop-on-error', 'Stop streaming at the first error') do
+    $options[:stop_on_error] = true
+  end
+  opts.on('-v', '--verbose', 'Echo every line and response') do
+    $options[:verbose] = true
+  end
   opts.on('-h', '--help', 'Display this screen') do
     puts opts
     exit
@@ -21,30 +50,155 @@ end
 options_parser.parse!
 if ARGV.empty?
   puts options_parser
-  exit
+  exit 1
+end
+
+$motion_mode = 0 # The firmware starts in G0
+
+# CRC-8 with polynomial 0x07, as checked by the firmware
+def crc8(bytes)
+  bytes.inject(0) do |crc, byte|
+    crc ^= byte
+    8.times { crc = (crc & 0x80 != 0) ? ((crc << 1) ^ 0x07) & 0xff : (crc << 1) & 0xff }
+    crc
+  end
+end
+
+# Returns the binary motion frame for a line made of nothing but G0/G1, X, Y, Z and F words, or nil.
+# Lines without a G word use the motion mode of the previous lines.
+def binary_frame(line)
+  words = line.upcase.gsub(/\s+/, '').scan(/([A-Z])([-+]?[0-9]*\.?[0-9]*)/)
+  return nil if words.empty? || words.map { |w| w.join }.join != line.upcase.gsub(/\s+/, '')
+  words.each do |letter, value|
+    $motion_mode = value.to_f if letter == 'G' && [0, 1, 2, 3, 80, 81, 82, 83].include?(value.to_f)
+  end
+  return nil unless [0, 1].include?($motion_mode)
+  return nil unless words.all? { |letter, value| letter =~ /[XYZF]/ || (letter == 'G' && value.to_f == $motion_mode) }
+  header = 0x80 | ($motion_mode.to_i << 4)
+  values = []
+  %w(X Y Z F).each_with_index do |axis, bit|
+    word = words.find { |letter, value| letter == axis }
+    next unless word
+    header |= 1 << bit
+    values << word[1].to_f
+  end
+  frame = [header].pack('C') + values.pack('e*')
+  frame + [crc8(frame.bytes.to_a)].pack('C') + "\n"
 end
 
-# SerialPort.open('/dev/tty.FireFly-A964-SPP-1', 115200) do |sp|
-SerialPort.open('/dev/tty.usbserial-A700e0GO', 9600) do |sp|
-  sp.write("\r\n\r\n");
-  sleep 1
-  ARGV.each do |file|
-    puts "Processing file #{file}"
-    prebuffer = $prebuffer ? 20 : 0
-    File.readlines(file).each do |line|
-      next if line.strip == ''
-      puts line.strip
-      sp.write("#{line.strip}\r\n");
-      if prebuffer == 0
-        begin
-          result = sp.gets.strip
-          puts "Grbl >> #{result}" #unless result == 'ok'
-        end while !(result =~ /^ok|^error/)
-      else
-        prebuffer -= 1
+# A line in flight: what was sent and when
+Sent = Struct.new(:file, :number, :text, :bytes, :time)
+
+class Streamer
+  attr_reader :errors
+
+  def initialize(port)
+    @port = port
+    @responses = Queue.new
+    @in_flight = []
+    @errors = 0
+    @lines = 0
+    @bytes = 0
+    @starved = 0         # Times the firmware had acknowledged everything while lines were left
+    @starved_time = 0.0  # Estimated time the firmware spent waiting for those lines
+    @drained_at = nil
+    @reader = Thread.new do
+      loop { @responses << @port.gets.to_s.strip }
+    end
+  end
+
+  def in_flight_bytes
+    @in_flight.inject(0) { |sum, sent| sum + sent.bytes }
+  end
+
+  # Sends a line, first waiting until the firmware has room for it
+  def stream_line(file, number, text)
+    data = ($options[:binary] && binary_frame(text)) || "#{text}\n"
+    if $options[:pipeline]
+      receive while @in_flight.any? && (in_flight_bytes + data.size > $options[:rx_buffer_size])
+    else
+      receive while @in_flight.any?
+    end
+    now = Time.now
+    if @drained_at
+      # The firmware waits for the host and then for the line itself to come down the wire
+      @starved += 1
+      @starved_time += (now - @drained_at) + data.size*10.0/$options[:baud]
+      @drained_at = nil
+    end
+    @started ||= now
+    @port.write(data)
+    @in_flight << Sent.new(file, number, text, data.size, now)
+    @lines += 1
+    @bytes += data.size
+    puts text if $options[:verbose]
+  end
+
+  # Waits for one response. Raises Interrupt when streaming must stop.
+  def receive
+    response = @responses.pop
+    return if response.empty?
+    if response =~ /^ALARM/
+      puts "Grbl >> #{response}"
+      raise Interrupt
+    end
+    unless response =~ /^(ok|error)/
+      puts "Grbl >> #{response}" # Startup banners, settings and other messages
+      return
+    end
+    sent = @in_flight.shift
+    @finished = Time.now
+    @drained_at = @finished if @in_flight.empty?
+    if response =~ /^error/
+      @errors += 1
+      puts "#{sent.file}:#{sent.number}: #{sent.text}" if sent
+      puts "Grbl >> #{response}"
+      raise Interrupt if $options[:stop_on_error]
+    elsif $options[:verbose]
+      puts "Grbl >> #{response}"
+    end
+  end
+
+  def finish
+    @drained_at = nil
+    receive while @in_flight.any?
+  end
+
+  def report
+    elapsed = (@finished || Time.now) - (@started || Time.now)
+    elapsed = 1e-6 if elapsed <= 0
+    bytes_per_second = @bytes/elapsed
+    puts "Sent %d lines, %d bytes in %.1f s" % [@lines, @bytes, elapsed]
+    puts "%.1f lines/s, %.0f bytes/s, %.0f%% of the %d baud link" %
+      [@lines/elapsed, bytes_per_second, 100.0*bytes_per_second*10/$options[:baud], $options[:baud]]
+    puts "Firmware waited for the host %d times, about %.1f s (%.0f%% of the job)" %
+      [@starved, @starved_time, 100.0*@starved_time/elapsed]
+    puts "%d errors" % @errors
+  end
+end
+
+streamer = nil
+begin
+  SerialPort.open($options[:port], $options[:baud]) do |sp|
+    sp.write("\r\n\r\n")
+    sleep 2 # The bootloader runs for a while after the port opens
+    streamer = Streamer.new(sp)
+    ARGV.each do |file|
+      puts "Streaming #{file}"
+      File.readlines(file).each_with_index do |line, index|
+        next if line.strip == ''
+        streamer.stream_line(file, index+1, line.strip)
       end
     end
+    streamer.finish
   end
-  puts "Done."
-  sleep 500
-end
\ No newline at end of file
+rescue Interrupt
+  puts "Stopped."
+rescue Errno::ENOENT, Errno::EACCES, Errno::EBUSY => e
+  puts "Could not open #{$options[:port]}: #{e.message}"
+  exit 1
+end
+if streamer
+  streamer.report
+  exit 1 if streamer.errors > 0
+end
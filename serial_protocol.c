@@ -26,11 +26,31 @@
 #include "config.h"
 #include <math.h>
 #include "nuts_bolts.h"
+#include "stepper.h"
+#include "spindle_control.h"
+#include "profile.h"
 #include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <string.h>
 #define LINE_BUFFER_SIZE 50
 
+// Binary motion frames (see serial_protocol.h)
+#define FRAME_HEADER_BIT 7
+#define FRAME_FEED_BIT 3
+#define FRAME_OPCODE(header) (((header) >> 4) & 0x07)
+#define FRAME_OPCODE_SEEK 0   // G0
+#define FRAME_OPCODE_LINEAR 1 // G1
+#define FRAME_END '\n'
+#define FRAME_BUFFER_SIZE (1+4*sizeof(float)+2)
+
 static char line[LINE_BUFFER_SIZE];
 static uint8_t char_counter;
+static uint8_t line_overflow;  // Set when the line did not fit the buffer. It is answered with an error.
+static uint8_t alarm_reported;
+static uint8_t frame[FRAME_BUFFER_SIZE];
+static uint8_t frame_counter;
+static uint8_t frame_size;     // Zero when not receiving a frame
+static uint8_t frame_resync;   // Set when a frame did not end in FRAME_END. Throws bytes away up to the next one.
 
 void status_message(int status_code) {
   switch(status_code) {          
@@ -44,6 +64,14 @@ void status_message(int status_code) {
     printPgmString(PSTR("error: Unsupported statement\n\r")); break;
     case GCSTATUS_FLOATING_POINT_ERROR:
     printPgmString(PSTR("error: Floating point error\n\r")); break;
+    case GCSTATUS_ALARM_LOCK:
+    printPgmString(PSTR("error: Alarm lock, reset to continue\n\r")); break;
+    case GCSTATUS_SOFT_LIMIT_ERROR:
+    printPgmString(PSTR("error: Target exceeds machine travel\n\r")); break;
+    case GCSTATUS_CHECKSUM_ERROR:
+    printPgmString(PSTR("error: Frame checksum mismatch\n\r")); break;
+    case GCSTATUS_LINE_OVERFLOW:
+    printPgmString(PSTR("error: Line too long\n\r")); break;
     default:
     printPgmString(PSTR("error: "));
     printInteger(status_code);
@@ -58,16 +86,127 @@ void sp_init()
   printPgmString(PSTR("\r\n"));  
 }
 
+// The size of the frame that starts with the given header: one word per flagged value, the header,
+// the checksum and FRAME_END
+static uint8_t frame_size_for(uint8_t header)
+{
+  uint8_t size = 3, bit;
+  for(bit=0; bit<=FRAME_FEED_BIT; bit++) {
+    if (header & (1<<bit)) { size += sizeof(float); }
+  }
+  return(size);
+}
+
+// Checks and executes a complete binary frame
+static uint8_t execute_frame()
+{
+  uint8_t crc = 0, i, header = frame[0];
+  uint8_t *data = frame+1;
+  double value[4]; // X, Y, Z and F
+  float word;
+  
+  // The checksum of a frame including its checksum byte is zero
+  for(i=0; i<frame_counter-1; i++) { crc = _crc8_ccitt_update(crc, frame[i]); }
+  if (crc) { return(GCSTATUS_CHECKSUM_ERROR); }
+  if (FRAME_OPCODE(header) > FRAME_OPCODE_LINEAR) { return(GCSTATUS_UNSUPPORTED_STATEMENT); }
+  for(i=0; i<=FRAME_FEED_BIT; i++) {
+    value[i] = -1;
+    if (header & (1<<i)) {
+      memcpy(&word, data, sizeof(float));
+      value[i] = word;
+      data += sizeof(float);
+    }
+  }
+  return(gc_execute_motion(FRAME_OPCODE(header) == FRAME_OPCODE_LINEAR, header & 0x07, value, 
+    value[FRAME_FEED_BIT]));
+}
+
 void sp_process()
 {
-  char c;
+  int c; // A char would take the data byte 0xff for the end of the buffer
+  if (st_alarm() && !alarm_reported) {
+    spindle_stop();
+    if (st_alarm() == ALARM_HOMING_FAIL) {
+      printPgmString(PSTR("ALARM: Homing failed, switch not found\n\r"));
+    } else {
+      printPgmString(PSTR("ALARM: Hard limit, position lost\n\r"));
+    }
+    alarm_reported = TRUE;
+  }
   while((c = serialRead()) != -1) 
   {
-    if((char_counter > 0) && ((c == '\n') || (c == '\r'))) {  // Line is complete. Then execute!
+    if (frame_resync) { 
+      // A byte was lost and the broken frame ran into what came next. That is thrown away up to its end
+      // and answered with an error too, so that the sender gets one answer for everything it sent.
+      if ((c == '\n') || (c == '\r')) {
+        status_message(GCSTATUS_CHECKSUM_ERROR);
+        frame_resync = FALSE;
+      }
+    } else if (frame_size) { // Every byte of a frame is data
+      if (frame_counter >= FRAME_BUFFER_SIZE) { 
+        // Cannot happen with the sizes frame_size_for() gives, but never write past the buffer
+        frame_size = 0;
+        status_message(GCSTATUS_CHECKSUM_ERROR);
+        frame_resync = TRUE;
+        continue;
+      }
+      frame[frame_counter++] = c;
+      if (frame_counter < frame_size) { continue; }
+      frame_size = 0;
+      if (c != FRAME_END) {
+        // Out of step with the sender. Bytes of the words could pass for headers, so wait for an end.
+        status_message(GCSTATUS_CHECKSUM_ERROR);
+        frame_resync = TRUE;
+      } else if (st_alarm()) {
+        status_message(GCSTATUS_ALARM_LOCK);
+      } else {
+#ifdef PROFILE
+        uint32_t profile_start = profile_time();
+        profile_executing(TRUE);
+#endif
+        uint8_t status = execute_frame();
+#ifdef PROFILE
+        profile_executing(FALSE);
+        profile_add(PROFILE_LINE, profile_start);
+#endif
+        status_message(status);
+      }
+    } else if ((char_counter == 0) && (c & (1<<FRAME_HEADER_BIT))) { // A frame starts between lines
+      frame[0] = c;
+      frame_counter = 1;
+      frame_size = frame_size_for(c);
+    } else if((char_counter > 0) && ((c == '\n') || (c == '\r'))) {  // Line is complete. Then execute!
       line[char_counter] = 0; // treminate string
-      status_message(gc_execute_line(line));
+#ifdef PROFILE
+      if (!strcmp(line, "$P")) {
+        profile_report();
+        status_message(GCSTATUS_OK);
+        char_counter = 0;
+        continue;
+      }
+#endif
+      if (line_overflow) {
+        status_message(GCSTATUS_LINE_OVERFLOW);
+        line_overflow = FALSE;
+      } else if (st_alarm() && (line[0] != '$')) {
+        // Nothing moves until reset, but settings may still be inspected and changed
+        status_message(GCSTATUS_ALARM_LOCK);
+      } else {
+#ifdef PROFILE
+        uint32_t profile_start = profile_time();
+        profile_executing(TRUE);
+#endif
+        uint8_t status = gc_execute_line(line);
+#ifdef PROFILE
+        profile_executing(FALSE);
+        profile_add(PROFILE_LINE, profile_start);
+#endif
+        status_message(status);
+      }
       char_counter = 0; // reset line buffer index
-    } else if (c <= ' ') { // Throw away whitepace and control characters
+    } else if ((c <= ' ') || (c & 0x80)) { // Throw away whitepace, control characters and bytes past ASCII
+    } else if (char_counter >= LINE_BUFFER_SIZE-1) { // The rest of a line too long for the buffer is lost
+      line_overflow = TRUE;
     } else if (c >= 'a' && c <= 'z') { // Upcase lowercase
       line[char_counter++] = c-'a'+'A';
     } else {
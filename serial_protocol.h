@@ -24,7 +24,20 @@
 void sp_init();
 
 // Read command lines from the serial port and execute them as they
-// come in. Blocks until the serial buffer is emptied. 
+// come in. Blocks until the serial buffer is emptied.
+//
+// Between lines the port also takes binary motion frames, which cost a third of the bytes of the
+// equivalent G-code and no number parsing:
+//
+//   header   1xxx xxxx  bits 6-4: opcode (0 = G0, 1 = G1), bit 3: F follows, bits 2-0: Z, Y, X follow
+//   words    a little endian IEEE 754 float for each flagged value, in the order X, Y, Z, F
+//   checksum the CRC-8 (polynomial 0x07, initial value 0) of the header and the words
+//   end      '\n'
+//
+// The values mean what the words of a G0 or G1 line would in the current modal state. Each frame
+// is answered like a line, with 'ok' or an error. A frame that does not end where its header says
+// lost a byte and swallowed the start of what followed. Both are answered with a checksum error and
+// the input is thrown away up to the next '\n' or '\r' to get back in step with the sender.
 void sp_process();
 
 #endif
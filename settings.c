@@ -22,34 +22,55 @@
 #include <math.h>
 #include "nuts_bolts.h"
 #include "settings.h"
+#include "config.h"
 #include "eeprom.h"
 #include "wiring_serial.h"
 #include <avr/pgmspace.h>
+#include <stddef.h>
 
 settings_t settings;
 
-// Version 1 outdated settings record
-typedef struct {
-  double steps_per_mm[3];
-  uint8_t microsteps;
-  uint8_t pulse_microseconds;
-  double default_feed_rate;
-  double default_seek_rate;
-  uint8_t invert_mask;
-  double mm_per_arc_segment;
-} settings_v1_t;
+// The size of the settings record written by each version. Every version has appended fields to the 
+// record of the version before, so an outdated record is a prefix of the current one.
+static const uint8_t settings_record_size[SETTINGS_VERSION+1] = {
+  0,
+  offsetof(settings_t, acceleration),    // Version 1
+  offsetof(settings_t, spindle_min_rpm), // Version 2
+  sizeof(settings_t)                     // Version 3
+};
 
 void settings_reset() {
   settings.steps_per_mm[X_AXIS] = DEFAULT_X_STEPS_PER_MM;
   settings.steps_per_mm[Y_AXIS] = DEFAULT_Y_STEPS_PER_MM;
   settings.steps_per_mm[Z_AXIS] = DEFAULT_Z_STEPS_PER_MM;
-  settings.pulse_microseconds = DEFAULT_STEP_PULSE_MICROSECONDS;
+  settings.pulse_microseconds = min(DEFAULT_STEP_PULSE_MICROSECONDS, MAX_STEP_TIMING_MICROSECONDS);
   settings.default_feed_rate = DEFAULT_FEEDRATE;
   settings.default_seek_rate = DEFAULT_RAPID_FEEDRATE;
   settings.acceleration = DEFAULT_ACCELERATION;
   settings.mm_per_arc_segment = DEFAULT_MM_PER_ARC_SEGMENT;
   settings.invert_mask = DEFAULT_STEPPING_INVERT_MASK;
   settings.max_jerk = DEFAULT_MAX_JERK;
+  settings.spindle_min_rpm = DEFAULT_SPINDLE_MIN_RPM;
+  settings.spindle_max_rpm = DEFAULT_SPINDLE_MAX_RPM;
+  settings.flags = DEFAULT_FLAGS;
+  settings.homing_dir_mask = DEFAULT_HOMING_DIR_MASK;
+  settings.homing_feed_rate = DEFAULT_HOMING_FEED_RATE;
+  settings.homing_seek_rate = DEFAULT_HOMING_SEEK_RATE;
+  settings.homing_debounce_delay = DEFAULT_HOMING_DEBOUNCE_DELAY;
+  settings.homing_pulloff = DEFAULT_HOMING_PULLOFF;
+  settings.max_travel[X_AXIS] = DEFAULT_X_MAX_TRAVEL;
+  settings.max_travel[Y_AXIS] = DEFAULT_Y_MAX_TRAVEL;
+  settings.max_travel[Z_AXIS] = DEFAULT_Z_MAX_TRAVEL;
+  settings.axis_acceleration[X_AXIS] = DEFAULT_X_ACCELERATION;
+  settings.axis_acceleration[Y_AXIS] = DEFAULT_Y_ACCELERATION;
+  settings.axis_acceleration[Z_AXIS] = DEFAULT_Z_ACCELERATION;
+  settings.max_rate[X_AXIS] = DEFAULT_X_MAX_RATE;
+  settings.max_rate[Y_AXIS] = DEFAULT_Y_MAX_RATE;
+  settings.max_rate[Z_AXIS] = DEFAULT_Z_MAX_RATE;
+  settings.junction_deviation = DEFAULT_JUNCTION_DEVIATION;
+  settings.jerk = DEFAULT_JERK;
+  settings.direction_setup_microseconds = DEFAULT_DIRECTION_SETUP_MICROSECONDS;
+  settings.stepper_idle_lock_time = DEFAULT_STEPPER_IDLE_LOCK_TIME;
 }
 
 void settings_dump() {
@@ -57,14 +78,41 @@ void settings_dump() {
   printPgmString(PSTR(" (steps/mm x)\r\n$1 = ")); printFloat(settings.steps_per_mm[Y_AXIS]);
   printPgmString(PSTR(" (steps/mm y)\r\n$2 = ")); printFloat(settings.steps_per_mm[Z_AXIS]);
   printPgmString(PSTR(" (steps/mm z)\r\n$3 = ")); printInteger(settings.pulse_microseconds);
-  printPgmString(PSTR(" (microseconds step pulse)\r\n$4 = ")); printFloat(settings.default_feed_rate);
+  printPgmString(PSTR(" (microseconds step pulse, at most ")); printInteger(MAX_STEP_TIMING_MICROSECONDS);
+  printPgmString(PSTR(")\r\n$4 = ")); printFloat(settings.default_feed_rate);
   printPgmString(PSTR(" (mm/min default feed rate)\r\n$5 = ")); printFloat(settings.default_seek_rate);
   printPgmString(PSTR(" (mm/min default seek rate)\r\n$6 = ")); printFloat(settings.mm_per_arc_segment);
   printPgmString(PSTR(" (mm/arc segment)\r\n$7 = ")); printInteger(settings.invert_mask); 
   printPgmString(PSTR(" (step port invert mask. binary = ")); printIntegerInBase(settings.invert_mask, 2);  
   printPgmString(PSTR(")\r\n$8 = ")); printFloat(settings.acceleration);
-  printPgmString(PSTR(" (acceleration in mm/sec^2)\r\n$9 = ")); printFloat(settings.max_jerk);
-  printPgmString(PSTR(" (max instant cornering speed change in delta mm/min)"));
+  printPgmString(PSTR(" (path acceleration limit in mm/sec^2, caps $24-$26 too)\r\n$9 = ")); printFloat(settings.max_jerk);
+  printPgmString(PSTR(" (max speed change from and to a stop in mm/min)\r\n$10 = ")); printFloat(settings.spindle_min_rpm);
+  printPgmString(PSTR(" (spindle rpm at minimum pwm)\r\n$11 = ")); printFloat(settings.spindle_max_rpm);
+  printPgmString(PSTR(" (spindle rpm at maximum pwm)\r\n$12 = ")); printInteger(bit_istrue(settings.flags, BITFLAG_LASER_MODE));
+  printPgmString(PSTR(" (laser mode, bool)\r\n$13 = ")); printInteger(bit_istrue(settings.flags, BITFLAG_HOMING_ENABLE));
+  printPgmString(PSTR(" (homing cycle, bool)\r\n$14 = ")); printInteger(settings.homing_dir_mask);
+  printPgmString(PSTR(" (homing direction invert mask. binary = ")); printIntegerInBase(settings.homing_dir_mask, 2);
+  printPgmString(PSTR(")\r\n$15 = ")); printFloat(settings.homing_feed_rate);
+  printPgmString(PSTR(" (homing locate rate, mm/min)\r\n$16 = ")); printFloat(settings.homing_seek_rate);
+  printPgmString(PSTR(" (homing seek rate, mm/min)\r\n$17 = ")); printInteger(settings.homing_debounce_delay);
+  printPgmString(PSTR(" (homing switch debounce, msec)\r\n$18 = ")); printFloat(settings.homing_pulloff);
+  printPgmString(PSTR(" (homing pull-off distance, mm)\r\n$19 = ")); printInteger(bit_istrue(settings.flags, BITFLAG_HARD_LIMIT_ENABLE));
+  printPgmString(PSTR(" (hard limits, bool)\r\n$20 = ")); printFloat(settings.max_travel[X_AXIS]);
+  printPgmString(PSTR(" (max travel x, mm)\r\n$21 = ")); printFloat(settings.max_travel[Y_AXIS]);
+  printPgmString(PSTR(" (max travel y, mm)\r\n$22 = ")); printFloat(settings.max_travel[Z_AXIS]);
+  printPgmString(PSTR(" (max travel z, mm)\r\n$23 = ")); printInteger(bit_istrue(settings.flags, BITFLAG_SOFT_LIMIT_ENABLE));
+  printPgmString(PSTR(" (soft limits, bool)\r\n$24 = ")); printFloat(settings.axis_acceleration[X_AXIS]);
+  printPgmString(PSTR(" (acceleration x, mm/sec^2)\r\n$25 = ")); printFloat(settings.axis_acceleration[Y_AXIS]);
+  printPgmString(PSTR(" (acceleration y, mm/sec^2)\r\n$26 = ")); printFloat(settings.axis_acceleration[Z_AXIS]);
+  printPgmString(PSTR(" (acceleration z, mm/sec^2)\r\n$27 = ")); printFloat(settings.max_rate[X_AXIS]);
+  printPgmString(PSTR(" (max rate x, mm/min)\r\n$28 = ")); printFloat(settings.max_rate[Y_AXIS]);
+  printPgmString(PSTR(" (max rate y, mm/min)\r\n$29 = ")); printFloat(settings.max_rate[Z_AXIS]);
+  printPgmString(PSTR(" (max rate z, mm/min)\r\n$30 = ")); printFloat(settings.junction_deviation);
+  printPgmString(PSTR(" (cornering junction deviation, mm)\r\n$31 = ")); printFloat(settings.jerk);
+  printPgmString(PSTR(" (jerk, mm/sec^3, 0 for trapezoids)\r\n$32 = ")); printInteger(settings.direction_setup_microseconds);
+  printPgmString(PSTR(" (microseconds direction setup, at most ")); printInteger(MAX_STEP_TIMING_MICROSECONDS);
+  printPgmString(PSTR(")\r\n$33 = ")); printInteger(settings.stepper_idle_lock_time);
+  printPgmString(PSTR(" (msec stepper idle lock time, 255 keeps them enabled)"));
   printPgmString(PSTR("\r\n'$x=value' to set parameter or just '$' to dump current settings\r\n"));
 }
 
@@ -77,26 +125,35 @@ int read_settings() {
   // Check version-byte of eeprom
   uint8_t version = eeprom_get_char(0);
   
-  if (version == SETTINGS_VERSION) {
-    // Read settings-record and check checksum
-    if (!(memcpy_from_eeprom_with_checksum((char*)&settings, 1, sizeof(settings_t)))) {
-      return(FALSE);
-    }
-  } else if (version == 1) {
-    // Migrate from old settings version
-    if (!(memcpy_from_eeprom_with_checksum((char*)&settings, 1, sizeof(settings_v1_t)))) {
-      return(FALSE);
-    }
-    settings.acceleration = DEFAULT_ACCELERATION;
-    settings.max_jerk = DEFAULT_MAX_JERK;
-  } else {      
+  if ((version == 0) || (version > SETTINGS_VERSION)) { return(FALSE); }
+  // Fields an outdated record does not have keep their default values
+  settings_reset();
+  // Read settings-record and check checksum
+  if (!(memcpy_from_eeprom_with_checksum((char*)&settings, 1, settings_record_size[version]))) {
     return(FALSE);
   }
+  if (version < 3) {
+    // Keep the motion of older setups as it was: every axis accelerates like the whole path did and runs
+    // at whatever F the program asks for until $27-$29 are set
+    uint8_t axis;
+    for(axis=0; axis<3; axis++) {
+      settings.axis_acceleration[axis] = settings.acceleration;
+      settings.max_rate[axis] = UNLIMITED_MAX_RATE;
+    }
+  }
+  // A build that busy-waits them takes no longer step timing than it accepts
+  settings.pulse_microseconds = min(settings.pulse_microseconds, MAX_STEP_TIMING_MICROSECONDS);
+  settings.direction_setup_microseconds = min(settings.direction_setup_microseconds, MAX_STEP_TIMING_MICROSECONDS);
   return(TRUE);
 }
 
 // A helper method to set settings from command line
 void settings_store_setting(int parameter, double value) {
+  if (((parameter == 3) || (parameter == 32)) && ((value < 0) || (round(value) > MAX_STEP_TIMING_MICROSECONDS))) {
+    printPgmString(PSTR("Out of range, at most ")); printInteger(MAX_STEP_TIMING_MICROSECONDS);
+    printPgmString(PSTR(" microseconds\r\n"));
+    return;
+  }
   switch(parameter) {
     case 0: case 1: case 2:
     settings.steps_per_mm[parameter] = value; break;
@@ -107,6 +164,39 @@ void settings_store_setting(int parameter, double value) {
     case 7: settings.invert_mask = trunc(value); break;
     case 8: settings.acceleration = value; break;
     case 9: settings.max_jerk = fabs(value); break;
+    case 10: settings.spindle_min_rpm = fabs(value); break;
+    case 11: settings.spindle_max_rpm = fabs(value); break;
+    case 12: 
+      if (value) { settings.flags |= BITFLAG_LASER_MODE; } 
+      else { settings.flags &= ~BITFLAG_LASER_MODE; }
+      break;
+    case 13: 
+      if (value) { settings.flags |= BITFLAG_HOMING_ENABLE; } 
+      else { settings.flags &= ~BITFLAG_HOMING_ENABLE; }
+      break;
+    case 14: settings.homing_dir_mask = trunc(value); break;
+    case 15: settings.homing_feed_rate = fabs(value); break;
+    case 16: settings.homing_seek_rate = fabs(value); break;
+    case 17: settings.homing_debounce_delay = round(value); break;
+    case 18: settings.homing_pulloff = fabs(value); break;
+    case 19: 
+      if (value) { settings.flags |= BITFLAG_HARD_LIMIT_ENABLE; } 
+      else { settings.flags &= ~BITFLAG_HARD_LIMIT_ENABLE; }
+      break;
+    case 20: case 21: case 22:
+    settings.max_travel[parameter-20] = fabs(value); break;
+    case 23: 
+      if (value) { settings.flags |= BITFLAG_SOFT_LIMIT_ENABLE; } 
+      else { settings.flags &= ~BITFLAG_SOFT_LIMIT_ENABLE; }
+      break;
+    case 24: case 25: case 26:
+    settings.axis_acceleration[parameter-24] = fabs(value); break;
+    case 27: case 28: case 29:
+    settings.max_rate[parameter-27] = fabs(value); break;
+    case 30: settings.junction_deviation = fabs(value); break;
+    case 31: settings.jerk = fabs(value); break;
+    case 32: settings.direction_setup_microseconds = round(value); break;
+    case 33: settings.stepper_idle_lock_time = min(round(fabs(value)), 255); break;
     default: 
       printPgmString(PSTR("Unknown parameter\r\n"));
       return;
@@ -115,6 +205,18 @@ void settings_store_setting(int parameter, double value) {
   printPgmString(PSTR("Stored new setting\r\n"));
 }
 
+void settings_read_coord_data(uint8_t index, double *coord_data) {
+  if (!memcpy_from_eeprom_with_checksum((char*)coord_data, 
+      EEPROM_ADDR_COORD_DATA+index*COORD_DATA_RECORD_SIZE, 3*sizeof(double))) {
+    memset(coord_data, 0, 3*sizeof(double));
+  }
+}
+
+void settings_write_coord_data(uint8_t index, double *coord_data) {
+  memcpy_to_eeprom_with_checksum(EEPROM_ADDR_COORD_DATA+index*COORD_DATA_RECORD_SIZE, 
+    (char*)coord_data, 3*sizeof(double));
+}
+
 // Initialize the config subsystem
 void settings_init() {
   if(read_settings()) {
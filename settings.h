@@ -29,9 +29,10 @@
 
 // Version of the EEPROM data. Will be used to migrate existing data from older versions of Grbl
 // when firmware is upgraded. Always stored in byte 0 of eeprom
-#define SETTINGS_VERSION 2
+#define SETTINGS_VERSION 3
 
-// Current global settings (persisted in EEPROM from byte 1 onwards)
+// Current global settings (persisted in EEPROM from byte 1 onwards). New fields must be appended
+// at the end so older records can be migrated (see read_settings()).
 typedef struct {
   double steps_per_mm[3];
   uint8_t microsteps;
@@ -42,9 +43,30 @@ typedef struct {
   double mm_per_arc_segment;
   double acceleration;
   double max_jerk;
+  double spindle_min_rpm;
+  double spindle_max_rpm;
+  uint8_t flags;  // Boolean settings, see BITFLAG_*
+  uint8_t homing_dir_mask;
+  double homing_feed_rate;
+  double homing_seek_rate;
+  uint16_t homing_debounce_delay;
+  double homing_pulloff;
+  double max_travel[3];
+  double axis_acceleration[3];
+  double max_rate[3];
+  double junction_deviation;
+  double jerk;  // mm/sec^3, zero for plain trapezoids
+  uint8_t direction_setup_microseconds;
+  uint8_t stepper_idle_lock_time; // ms the drivers stay enabled after motion, 255 for always
 } settings_t;
 extern settings_t settings;
 
+// Bits of settings.flags
+#define BITFLAG_LASER_MODE (1<<0) // Spindle output drives a laser: power follows speed, M3/M5 don't stop motion
+#define BITFLAG_HOMING_ENABLE (1<<1) // G28/G30 run the homing cycle
+#define BITFLAG_HARD_LIMIT_ENABLE (1<<2) // Triggering a limit switch kills motion and raises an alarm
+#define BITFLAG_SOFT_LIMIT_ENABLE (1<<3) // Lines with targets outside max_travel are refused
+
 // Initialize the configuration subsystem (load settings from EEPROM)
 void settings_init();
 
@@ -54,6 +76,18 @@ void settings_dump();
 // A helper method to set new settings from command line
 void settings_store_setting(int parameter, double value);
 
+// The offsets of the work coordinate systems G54-G59 are kept in EEPROM apart from the settings record, 
+// one checksummed record of three doubles (mm) per system from EEPROM_ADDR_COORD_DATA on.
+#define N_COORDINATE_SYSTEMS 6
+#define EEPROM_ADDR_COORD_DATA 512
+#define COORD_DATA_RECORD_SIZE (3*sizeof(double)+1)
+
+// Reads the offsets of coordinate system index (0 for G54). Blank or damaged records read as zero offsets.
+void settings_read_coord_data(uint8_t index, double *coord_data);
+
+// Stores the offsets of coordinate system index (0 for G54)
+void settings_write_coord_data(uint8_t index, double *coord_data);
+
 // Default settings (used when resetting eeprom-settings)
 #define MICROSTEPS 8
 #define DEFAULT_X_STEPS_PER_MM (94.488188976378*MICROSTEPS)
@@ -64,7 +98,29 @@ void settings_store_setting(int parameter, double value);
 #define DEFAULT_RAPID_FEEDRATE 480.0 // in millimeters per minute
 #define DEFAULT_FEEDRATE 480.0
 #define DEFAULT_ACCELERATION (DEFAULT_FEEDRATE/100.0)
+#define DEFAULT_X_ACCELERATION DEFAULT_ACCELERATION // mm/sec^2
+#define DEFAULT_Y_ACCELERATION DEFAULT_ACCELERATION // mm/sec^2
+#define DEFAULT_Z_ACCELERATION DEFAULT_ACCELERATION // mm/sec^2
+#define UNLIMITED_MAX_RATE 1000000.0 // mm/min, no limit in practice. Fresh and migrated settings run at any F.
+#define DEFAULT_X_MAX_RATE UNLIMITED_MAX_RATE // mm/min
+#define DEFAULT_Y_MAX_RATE UNLIMITED_MAX_RATE // mm/min
+#define DEFAULT_Z_MAX_RATE UNLIMITED_MAX_RATE // mm/min
 #define DEFAULT_MAX_JERK 50.0
+#define DEFAULT_JUNCTION_DEVIATION 0.05 // mm
+#define DEFAULT_JERK 0.0 // mm/sec^3, S-curves off
+#define DEFAULT_DIRECTION_SETUP_MICROSECONDS 0
+#define DEFAULT_STEPPER_IDLE_LOCK_TIME 255 // ms, drivers always enabled
 #define DEFAULT_STEPPING_INVERT_MASK 0
+#define DEFAULT_SPINDLE_MIN_RPM 0.0
+#define DEFAULT_SPINDLE_MAX_RPM 10000.0
+#define DEFAULT_FLAGS 0
+#define DEFAULT_HOMING_DIR_MASK 0 // Home all axes toward their negative end
+#define DEFAULT_HOMING_FEED_RATE 25.0 // mm/min
+#define DEFAULT_HOMING_SEEK_RATE 250.0 // mm/min
+#define DEFAULT_HOMING_DEBOUNCE_DELAY 10 // msec
+#define DEFAULT_HOMING_PULLOFF 1.0 // mm
+#define DEFAULT_X_MAX_TRAVEL 200.0 // mm
+#define DEFAULT_Y_MAX_TRAVEL 200.0 // mm
+#define DEFAULT_Z_MAX_TRAVEL 200.0 // mm
 
 #endif
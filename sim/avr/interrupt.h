@@ -0,0 +1,8 @@
+// Host stand-in: interrupt handlers are ordinary functions the simulator calls when they come due
+#ifndef sim_avr_interrupt_h
+#define sim_avr_interrupt_h
+#define SIGNAL(vector) void vector(void)
+#define ISR(vector) void vector(void)
+#define cli()
+#define sei()
+#endif
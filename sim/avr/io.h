@@ -0,0 +1,41 @@
+// Host stand-in for the AVR register definitions. The registers are plain variables (defined in
+// host.c) that the simulators read and advance as the hardware would.
+#ifndef sim_avr_io_h
+#define sim_avr_io_h
+#include <inttypes.h>
+#define __AVR_ATmega328P__ 1
+
+extern volatile uint8_t DDRB, PORTB, PINB, DDRD, PORTD, PIND;
+extern volatile uint8_t TCCR0A, TCCR0B, OCR0A, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+extern volatile uint8_t PCICR, PCIFR, PCMSK0;
+extern volatile uint8_t SREG;
+
+// Timer 0 counts a cycle further each time it is read, so busy-waits on it come to an end
+uint8_t *sim_timer0();
+#define TCNT0 (*sim_timer0())
+
+#define TOV0 0
+#define OCF0A 1
+#define TOIE0 0
+#define OCIE0A 1
+#define CS01 1
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define COM1B0 4
+#define COM1A0 6
+#define CS10 0
+#define OCIE1A 1
+#define OCF1A 1
+#define TOIE2 0
+#define WGM20 0
+#define WGM21 1
+#define COM2A1 7
+#define CS22 2
+#define PCIE0 0
+#define PCIF0 0
+#endif
@@ -0,0 +1,10 @@
+// Host stand-in: program memory is ordinary memory on a PC
+#ifndef sim_avr_pgmspace_h
+#define sim_avr_pgmspace_h
+#include <inttypes.h>
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#endif
@@ -0,0 +1,5 @@
+// Host stand-in: sleeping lets virtual time run on to the next event
+#ifndef sim_avr_sleep_h
+#define sim_avr_sleep_h
+#define sleep_mode() sim_sleep()
+#endif
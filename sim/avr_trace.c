@@ -0,0 +1,240 @@
+/*
+  avr_trace.c - runs the Grbl firmware on simavr and logs its step pulses
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Loads main.elf into a simulated atmega328p, streams a G-code file to it over the UART (counting
+   characters like script/stream.rb --pipeline) and writes every edge of the step and direction pins
+   with the CPU cycle it happened on:
+
+     # f_cpu 16000000
+     cycle,signal,level
+     1234567,X_STEP,1
+
+   A summary of the steps per axis and the shortest step interval goes to stderr. The pin
+   assignment comes from config.h, so rebuild after changing it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+#include "avr_ioport.h"
+#include "config.h"
+
+#define F_CPU 16000000
+#define RX_WINDOW 200          // Bytes in flight, well inside the 256 byte receive buffer of the firmware
+#define IDLE_SECONDS 1.0       // How long the pins must stay quiet after the last 'ok' to end the run
+#define STR(x) #x
+#define PORT_LETTER(port) (STR(port)[sizeof(STR(port))-2]) // PORTD -> 'D'
+
+typedef struct {
+  const char *name;
+  uint8_t bit;
+  uint64_t count;              // Rising edges (for step pins)
+  avr_cycle_count_t last_rise;
+  avr_cycle_count_t min_interval;
+} signal_t;
+
+static signal_t signals[] = {
+  { "X_STEP", X_STEP_BIT }, { "Y_STEP", Y_STEP_BIT }, { "Z_STEP", Z_STEP_BIT },
+  { "X_DIR", X_DIRECTION_BIT }, { "Y_DIR", Y_DIRECTION_BIT }, { "Z_DIR", Z_DIRECTION_BIT },
+};
+#define N_SIGNALS (sizeof(signals)/sizeof(signals[0]))
+#define N_STEP_SIGNALS 3
+
+static avr_t *avr;
+static FILE *trace;
+static avr_cycle_count_t last_edge;
+
+// The G-code being streamed
+static char *input;
+static long input_size, input_sent;
+static int line_sizes[RX_WINDOW];      // The sizes of the lines not acknowledged yet, oldest first
+static int lines_in_flight, bytes_in_flight;
+static long answered, errors;
+static avr_cycle_count_t last_answer;
+static char response[80];
+static int response_size;
+static int verbose;
+
+static void pin_changed(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+  signal_t *signal = param;
+  fprintf(trace, "%llu,%s,%u\n", (unsigned long long)avr->cycle, signal->name, value);
+  last_edge = avr->cycle;
+  if (value && (signal < signals+N_STEP_SIGNALS)) {
+    if (signal->count && (!signal->min_interval || (avr->cycle-signal->last_rise < signal->min_interval))) {
+      signal->min_interval = avr->cycle-signal->last_rise;
+    }
+    signal->last_rise = avr->cycle;
+    signal->count++;
+  }
+}
+
+static void uart_output(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+  if (verbose) { fputc(value, stderr); }
+  if ((value != '\n') && (value != '\r')) {
+    if (response_size < sizeof(response)-1) { response[response_size++] = value; }
+    return;
+  }
+  response[response_size] = 0;
+  if (!strncmp(response, "ok", 2) || !strncmp(response, "error", 5)) {
+    if (response[0] == 'e') {
+      errors++;
+      fprintf(stderr, "%s\n", response);
+    }
+    answered++;
+    last_answer = avr->cycle;
+    if (lines_in_flight) {
+      bytes_in_flight -= line_sizes[0];
+      memmove(line_sizes, line_sizes+1, --lines_in_flight*sizeof(int));
+    }
+  }
+  response_size = 0;
+}
+
+// The size of the next line including its newline
+static int next_line_size()
+{
+  char *end = memchr(input+input_sent, '\n', input_size-input_sent);
+  return(end ? end-(input+input_sent)+1 : input_size-input_sent);
+}
+
+// Blank lines get no answer
+static int next_line_blank()
+{
+  int i, size = next_line_size();
+  for(i=0; i<size; i++) {
+    if ((unsigned char)input[input_sent+i] > ' ') { return(0); }
+  }
+  return(1);
+}
+
+static char *read_file(const char *path, long *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file) { return(NULL); }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  rewind(file);
+  char *data = malloc(*size+1);
+  *size = fread(data, 1, *size, file);
+  fclose(file);
+  return(data);
+}
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: avr_trace [options] gcode-file > trace.csv\n"
+    "  -f elf     The firmware (default ../main.elf)\n"
+    "  -s seconds Stop after this much simulated time (default 3600)\n"
+    "  -v         Print the output of Grbl on stderr\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *elf = "../main.elf";
+  double max_seconds = 3600;
+  int option, i;
+  while ((option = getopt(argc, argv, "f:s:v")) != -1) {
+    switch (option) {
+      case 'f': elf = optarg; break;
+      case 's': max_seconds = atof(optarg); break;
+      case 'v': verbose = 1; break;
+      default: usage();
+    }
+  }
+  if (optind != argc-1) { usage(); }
+  if (!(input = read_file(argv[optind], &input_size))) {
+    perror(argv[optind]);
+    return(1);
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(elf, &firmware)) {
+    fprintf(stderr, "Could not read %s (make -C .. main.elf)\n", elf);
+    return(1);
+  }
+  strcpy(firmware.mmcu, "atmega328p");
+  firmware.frequency = F_CPU;
+  avr = avr_make_mcu_by_name(firmware.mmcu);
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+
+  // Take the UART off stdout and listen to it
+  uint32_t flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+  avr_irq_t *uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), uart_output, NULL);
+
+  // The limit switches are open: the pull-ups hold the pins high
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PORT_LETTER(LIMIT_PORT)), X_LIMIT_BIT), 1);
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PORT_LETTER(LIMIT_PORT)), Y_LIMIT_BIT), 1);
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PORT_LETTER(LIMIT_PORT)), Z_LIMIT_BIT), 1);
+
+  trace = stdout;
+  fprintf(trace, "# f_cpu %d\ncycle,signal,level\n", F_CPU);
+  for(i=0; i<N_SIGNALS; i++) {
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(PORT_LETTER(STEPPING_PORT)),
+      signals[i].bit), pin_changed, &signals[i]);
+  }
+
+  avr_cycle_count_t byte_cycles = (avr_cycle_count_t)F_CPU*10/BAUD_RATE;
+  avr_cycle_count_t next_byte = avr_usec_to_cycles(avr, 2000000); // Let the firmware boot first
+  avr_cycle_count_t idle_cycles = IDLE_SECONDS*F_CPU;
+  avr_cycle_count_t max_cycles = max_seconds*F_CPU;
+  int state = cpu_Running;
+  while ((state != cpu_Done) && (state != cpu_Crashed) && (avr->cycle < max_cycles)) {
+    state = avr_run(avr);
+    if ((input_sent < input_size) && (avr->cycle >= next_byte)) {
+      // Start a new line only when it fits in the receive buffer with those in flight
+      if (((input_sent == 0) || (input[input_sent-1] == '\n')) && !next_line_blank()) {
+        int size = next_line_size();
+        if ((lines_in_flight == RX_WINDOW) || (lines_in_flight && (bytes_in_flight+size > RX_WINDOW))) {
+          continue;
+        }
+        line_sizes[lines_in_flight++] = size;
+        bytes_in_flight += size;
+      }
+      avr_raise_irq(uart_in, input[input_sent++]);
+      next_byte = avr->cycle+byte_cycles;
+    }
+    if ((input_sent == input_size) && !lines_in_flight &&
+        (avr->cycle > last_answer+idle_cycles) && (avr->cycle > last_edge+idle_cycles)) { break; }
+  }
+
+  fprintf(stderr, "%ld lines answered (%ld errors) in %.3f s simulated\n", answered, errors,
+    (double)avr->cycle/F_CPU);
+  for(i=0; i<N_STEP_SIGNALS; i++) {
+    fprintf(stderr, "%s: %llu steps, shortest interval %llu cycles (%.0f steps/s)\n", signals[i].name,
+      (unsigned long long)signals[i].count, (unsigned long long)signals[i].min_interval,
+      signals[i].min_interval ? (double)F_CPU/signals[i].min_interval : 0.0);
+  }
+  if (state == cpu_Crashed) { fprintf(stderr, "The firmware crashed\n"); }
+  return((errors || (state == cpu_Crashed)) ? 1 : 0);
+}
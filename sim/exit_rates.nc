@@ -0,0 +1,9 @@
+(Long and short moves with S-curves, each block must leave at its final rate: make check)
+$31=20
+G1 X30 F600
+G1 X32
+G1 X62
+G1 X64 Y2
+G1 X94 Y2
+G1 X96
+G0 X0 Y0
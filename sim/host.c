@@ -0,0 +1,108 @@
+/*
+  host.c - what the host programs share: the registers, the EEPROM and the parts of avr-libc that differ
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "eeprom.h"
+
+#undef strtod
+
+#define EEPROM_SIZE 1024
+
+volatile uint8_t DDRB, PORTB, PINB, DDRD, PORTD, PIND;
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+volatile uint8_t PCICR, PCIFR, PCMSK0;
+volatile uint8_t SREG;
+
+static char eeprom[EEPROM_SIZE];
+
+double sim_strtod(const char *s, char **end)
+{
+  char number[32];
+  int i = 0;
+  while ((i < sizeof(number)-1) && s[i] && (strchr("+-.0123456789", s[i]) != NULL)) { number[i] = s[i]; i++; }
+  number[i] = 0;
+  char *number_end;
+  double value = strtod(number, &number_end);
+  if (end) { *end = (char *)s+(number_end-number); }
+  return(value);
+}
+
+char *sim_read_file(const char *path, long *size)
+{
+  FILE *file = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+  if (!file) { return(NULL); }
+  long capacity = 1<<16;
+  char *data = malloc(capacity);
+  *size = 0;
+  size_t count;
+  while ((count = fread(data+*size, 1, capacity-*size, file)) > 0) {
+    *size += count;
+    if (*size == capacity) { data = realloc(data, capacity *= 2); }
+  }
+  if (file != stdin) { fclose(file); }
+  return(data);
+}
+
+// The virtual EEPROM
+
+char eeprom_get_char(unsigned int addr)
+{
+  return(eeprom[addr % EEPROM_SIZE]);
+}
+
+void eeprom_put_char(unsigned int addr, char new_value)
+{
+  eeprom[addr % EEPROM_SIZE] = new_value;
+}
+
+void memcpy_to_eeprom_with_checksum(unsigned int destination, char *source, unsigned int size)
+{
+  unsigned char checksum = 0;
+  for(; size > 0; size--) {
+    checksum = (checksum << 1) | (checksum >> 7);
+    checksum += *source;
+    eeprom_put_char(destination++, *(source++));
+  }
+  eeprom_put_char(destination, checksum);
+}
+
+int memcpy_from_eeprom_with_checksum(char *destination, unsigned int source, unsigned int size)
+{
+  unsigned char data, checksum = 0;
+  for(; size > 0; size--) {
+    data = eeprom_get_char(source++);
+    checksum = (checksum << 1) | (checksum >> 7);
+    checksum += data;
+    *(destination++) = data;
+  }
+  return(checksum == (unsigned char)eeprom_get_char(source));
+}
+
+uint8_t *sim_timer0()
+{
+  static uint8_t count;
+  count++;
+  return(&count);
+}
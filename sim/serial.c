@@ -0,0 +1,184 @@
+/*
+  serial.c - the serial port of the simulator, standing in for wiring_serial.c
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The host streams the input at the baud rate for as long as the receive buffer has room, as a
+// sender that counts characters would. Everything Grbl prints is counted and optionally echoed.
+
+#include <stdio.h>
+#include <string.h>
+#include "wiring_serial.h"
+#include "nuts_bolts.h"
+
+#define RX_BUFFER_SIZE 256 // As on the atmega328p
+#define OUTPUT_LINE_SIZE 80
+
+static unsigned char rx_buffer[RX_BUFFER_SIZE];
+static int rx_buffer_head;
+static int rx_buffer_tail;
+
+static const char *input;
+static long input_size;
+static long input_sent;
+static double byte_time;     // Seconds per byte on the line, zero for an infinitely fast line
+static double next_arrival;
+
+static char output_line[OUTPUT_LINE_SIZE];
+static int output_counter;
+
+double sim_serial_done_time;
+long sim_lines_answered;
+long sim_errors;
+int sim_echo;
+double sim_line_time;
+
+static int rx_buffer_full()
+{
+  return((rx_buffer_head+1) % RX_BUFFER_SIZE == rx_buffer_tail);
+}
+
+void sim_serial_open(const char *data, long size, long baud)
+{
+  input = data;
+  input_size = size;
+  input_sent = 0;
+  byte_time = baud ? 10.0/baud : 0; // A start bit, 8 data bits and a stop bit
+  next_arrival = sim_time+byte_time;
+}
+
+double sim_serial_next_arrival()
+{
+  if ((input_sent == input_size) || rx_buffer_full()) { return(INFINITY); }
+  return(next_arrival);
+}
+
+void sim_serial_arrive()
+{
+  rx_buffer[rx_buffer_head] = input[input_sent++];
+  rx_buffer_head = (rx_buffer_head + 1) % RX_BUFFER_SIZE;
+  next_arrival += byte_time;
+}
+
+int sim_serial_done()
+{
+  return((input_sent == input_size) && (rx_buffer_head == rx_buffer_tail));
+}
+
+void beginSerial(long baud) {}
+
+int serialAvailable()
+{
+  return (RX_BUFFER_SIZE + rx_buffer_head - rx_buffer_tail) % RX_BUFFER_SIZE;
+}
+
+int serialRead()
+{
+  if (rx_buffer_head == rx_buffer_tail) { return -1; }
+  // The sender held back while the buffer was full and resumes now
+  if (rx_buffer_full()) { next_arrival = max(next_arrival, sim_time+byte_time); }
+  unsigned char c = rx_buffer[rx_buffer_tail];
+  rx_buffer_tail = (rx_buffer_tail + 1) % RX_BUFFER_SIZE;
+  if (sim_serial_done()) { sim_serial_done_time = sim_time; }
+  return c;
+}
+
+void serialFlush()
+{
+  rx_buffer_head = rx_buffer_tail;
+}
+
+void serialWrite(unsigned char c)
+{
+  if (sim_echo) { putchar(c); }
+  if (c == '\n') {
+    output_line[output_counter] = 0;
+    if (!strncmp(output_line, "ok", 2) || !strncmp(output_line, "error", 5)) {
+      sim_lines_answered++;
+      if (output_line[0] == 'e') { sim_errors++; }
+      sim_delay(sim_line_time);
+    }
+    output_counter = 0;
+  } else if (c != '\r' && output_counter < OUTPUT_LINE_SIZE-1) {
+    output_line[output_counter++] = c;
+  }
+}
+
+void printMode(int mode) {}
+
+void printByte(unsigned char c)
+{
+  serialWrite(c);
+}
+
+void printNewline()
+{
+  printByte('\n');
+}
+
+void printString(const char *s)
+{
+  while (*s) { printByte(*s++); }
+}
+
+void printPgmString(const char *s)
+{
+  printString(s);
+}
+
+void printIntegerInBase(unsigned long n, unsigned long base)
+{
+  char buf[8 * sizeof(long) + 1];
+  int i = 0;
+  do {
+    buf[i++] = "0123456789ABCDEF"[n % base];
+    n /= base;
+  } while (n);
+  while (i) { printByte(buf[--i]); }
+}
+
+void printInteger(long n)
+{
+  if (n < 0) {
+    printByte('-');
+    n = -n;
+  }
+  printIntegerInBase(n, 10);
+}
+
+void printHex(unsigned long n)
+{
+  printIntegerInBase(n, 16);
+}
+
+void printOctal(unsigned long n)
+{
+  printIntegerInBase(n, 8);
+}
+
+void printBinary(unsigned long n)
+{
+  printIntegerInBase(n, 2);
+}
+
+void printFloat(double n)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", n);
+  printString(buf);
+}
@@ -0,0 +1,263 @@
+/*
+  sim.c - runs Grbl on a PC in virtual time
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The real serial protocol, parser, motion control, planner, settings and spindle control run on top
+   of a virtual serial line (serial.c) and a virtual stepper that executes each block in the time its
+   trapezoid takes. Virtual time only passes while Grbl waits: for a byte, for room in the block
+   buffer, for a dwell or for motion to finish. The host time spent parsing and planning is measured
+   separately.
+
+   The timing of the motion is idealised: stepper.c does not run here, and block_duration() takes
+   the planned trapezoid at face value. It knows nothing of the acceleration ticks, the rounding of
+   the step timer or the S-curve ramps, which the average of the rates only approximates. For the
+   timing stepper.c really produces, use trapezoid. The two usually agree within a few percent.
+
+   The serial line is not a pty or pipe to a real sender but an in-process stand-in for
+   wiring_serial.c. It feeds the input at the baud rate and counts the answers, as a sender that
+   counts characters would, so throughput can be measured in virtual time and without a host. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "planner.h"
+#include "stepper.h"
+#include "spindle_control.h"
+#include "gcode.h"
+#include "serial_protocol.h"
+#include "settings.h"
+#include "config.h"
+#include "nuts_bolts.h"
+#include "wiring_serial.h"
+
+double sim_time;
+
+static block_t *current_block;  // The block the virtual stepper is executing
+static double block_end;        // When it will be done
+static int blocks_buffered;     // The blocks in the planner buffer, the current one included
+static FILE *plan_file;         // Where to write the blocks as they start, NULL for nowhere
+
+// Statistics
+static double first_motion = -1;  // When the first block started
+static double fill_integral;      // Blocks buffered integrated over the virtual time they were buffered
+static double fill_accounted;     // The time fill_integral runs up to
+static int min_fill = -1;         // The fewest blocks buffered when a block finished while streaming
+static int max_fill;
+static long underruns;            // Times the buffer ran empty while the job was still streaming
+static double starved_time;       // Virtual time spent idle while the job was still streaming
+static double starved_since = -1;
+static long blocks_executed;
+
+static void account_fill()
+{
+  if (first_motion >= 0) { fill_integral += blocks_buffered*(sim_time-fill_accounted); }
+  fill_accounted = sim_time;
+}
+
+// The time the block takes: accelerating from the initial rate to the peak rate, cruising and
+// decelerating to the final rate, each at the average of its rates
+static double block_duration(block_t *block)
+{
+  double initial_rate = max(block->initial_rate, 1);
+  double peak_rate = max(block->peak_rate, 1);
+  double final_rate = max(block->final_rate, 1);
+  double accelerating = block->accelerate_until;
+  double decelerating = block->step_event_count-block->decelerate_after;
+  double cruising = block->step_event_count-accelerating-decelerating;
+  return(60*(2*accelerating/(initial_rate+peak_rate) + cruising/peak_rate +
+    2*decelerating/(peak_rate+final_rate)));
+}
+
+static void start_block()
+{
+  current_block = plan_get_current_block();
+  if (!current_block) { return; }
+  if (first_motion < 0) {
+    first_motion = sim_time;
+    fill_accounted = sim_time;
+  }
+  if (starved_since >= 0) {
+    starved_time += sim_time-starved_since;
+    starved_since = -1;
+  }
+  block_end = sim_time+block_duration(current_block);
+  if (plan_file) {
+    fprintf(plan_file, "%.6f,%u,%u,%u,%u,%d,%u,%u,%u,%u,%d,%d,%u,%u\n", sim_time, current_block->steps_x, 
+      current_block->steps_y, current_block->steps_z, current_block->direction_bits, 
+      current_block->step_event_count, current_block->nominal_rate, current_block->initial_rate, 
+      current_block->peak_rate, current_block->final_rate, current_block->rate_delta, 
+      current_block->jerk_delta, current_block->accelerate_until, current_block->decelerate_after);
+  }
+}
+
+static void finish_block()
+{
+  account_fill();
+  plan_discard_current_block();
+  blocks_buffered--;
+  blocks_executed++;
+  if (!sim_serial_done()) {
+    if ((min_fill < 0) || (blocks_buffered < min_fill)) { min_fill = blocks_buffered; }
+    if (!blocks_buffered) {
+      underruns++;
+      starved_since = sim_time;
+    }
+  }
+  start_block();
+}
+
+void sim_run_until(double time)
+{
+  for(;;) {
+    double next = sim_serial_next_arrival();
+    if (current_block && (block_end < next)) { next = block_end; }
+    if (next > time) { break; }
+    sim_time = next;
+    if (current_block && (block_end <= sim_time)) { finish_block(); } else { sim_serial_arrive(); }
+  }
+  sim_time = max(sim_time, time);
+}
+
+void sim_sleep()
+{
+  double next = sim_serial_next_arrival();
+  if (current_block && (block_end < next)) { next = block_end; }
+  if (next < INFINITY) { sim_run_until(next); }
+}
+
+void sim_delay(double seconds)
+{
+  sim_run_until(sim_time+seconds);
+}
+
+// The virtual stepper
+
+void st_init() {}
+
+void st_wake_up()
+{
+  // Only called by the planner when it has added a block
+  account_fill();
+  blocks_buffered++;
+  max_fill = max(max_fill, blocks_buffered);
+  if (!current_block) { start_block(); }
+}
+
+void st_synchronize()
+{
+  while (current_block) { sim_run_until(block_end); }
+}
+
+void st_go_home()
+{
+  st_synchronize();
+}
+
+uint8_t st_alarm()
+{
+  return(FALSE);
+}
+
+uint16_t st_overruns()
+{
+  return(0);
+}
+
+static double host_seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(now.tv_sec+now.tv_nsec/1e9);
+}
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: grbl_sim [options] gcode-file ('-' reads stdin)\n"
+    "  -b baud   The baud rate of the serial line, 0 for an infinitely fast line (default %ld)\n"
+    "  -l us     Virtual microseconds charged for executing each line, to stand in for the AVR (default 0)\n"
+    "  -p file   Write the blocks as they start executing to file as CSV\n"
+    "  -v        Print everything Grbl prints\n"
+    "The motion timing is idealised from the planned trapezoids. trapezoid runs the real stepper.c.\n",
+    (long)BAUD_RATE);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  long baud = BAUD_RATE;
+  int option;
+  while ((option = getopt(argc, argv, "b:l:p:v")) != -1) {
+    switch (option) {
+      case 'b': baud = atol(optarg); break;
+      case 'l': sim_line_time = atof(optarg)/1e6; break;
+      case 'p': 
+      if (!(plan_file = fopen(optarg, "w"))) {
+        perror(optarg);
+        return(1);
+      }
+      fprintf(plan_file, "time,steps_x,steps_y,steps_z,direction_bits,step_event_count,nominal_rate,"
+        "initial_rate,peak_rate,final_rate,rate_delta,jerk_delta,accelerate_until,decelerate_after\n");
+      break;
+      case 'v': sim_echo = TRUE; break;
+      default: usage();
+    }
+  }
+  if (optind != argc-1) { usage(); }
+  long size;
+  char *data = sim_read_file(argv[optind], &size);
+  if (!data) {
+    perror(argv[optind]);
+    return(1);
+  }
+
+  sp_init();
+  settings_init();
+  plan_init();
+  st_init();
+  spindle_init();
+  gc_init();
+
+  sim_serial_open(data, size, baud);
+  double started = host_seconds();
+  while (!sim_serial_done()) {
+    sp_process();
+    double before = sim_time;
+    sim_sleep();
+    if ((sim_time == before) && !current_block && !serialAvailable() && (sim_serial_next_arrival() == INFINITY)) { 
+      break; // Nothing left that could happen, e.g. the input ends in the middle of a line
+    }
+  }
+  st_synchronize();
+  account_fill();
+  if (plan_file) { fclose(plan_file); }
+  double host_time = host_seconds()-started;
+
+  printf("%ld lines answered (%ld errors), %ld bytes at %ld baud\n", sim_lines_answered, sim_errors, size, baud);
+  printf("Host:    %.3f s, %.0f lines/s through sp_process()\n", host_time, sim_lines_answered/host_time);
+  printf("Virtual: %.3f s job (idealised motion), %.3f s streaming, first motion after %.3f s\n", sim_time, 
+    sim_serial_done_time,
+    max(first_motion, 0));
+  printf("Planner: %ld blocks, %.1f buffered on average, at most %d, at least %d while streaming\n", 
+    blocks_executed, (sim_time > first_motion) ? fill_integral/(sim_time-first_motion) : 0, max_fill, 
+    max(min_fill, 0));
+  printf("         %ld underruns, idle for %.3f s while streaming\n", underruns, starved_time);
+  return(sim_errors ? 1 : 0);
+}
@@ -0,0 +1,64 @@
+/*
+  sim.h - runs Grbl on a PC in virtual time
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Included ahead of every source of the host build (see the Makefile). Supplies what avr-libc adds
+// to the standard headers and the hooks the stand-in headers in avr/ and util/ call.
+
+#ifndef sim_h
+#define sim_h
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <math.h>
+
+// avr-libc has square() in math.h
+static inline double square(double x) { return(x*x); }
+
+// The strtod() of glibc also reads hexadecimal, so "G0X5" would come out as G with the value 5.
+// sim_strtod() reads decimal numbers only, like the strtod() of avr-libc.
+double sim_strtod(const char *s, char **end);
+#define strtod(s, end) sim_strtod(s, end)
+
+// Reads a whole file, '-' for stdin. NULL if it could not be opened.
+char *sim_read_file(const char *path, long *size);
+
+extern double sim_time;             // Seconds of virtual time since power up
+
+// Lets virtual time run on to the next event: the end of the running block or the arrival of a byte
+void sim_sleep();
+
+// Lets the given number of seconds pass in virtual time
+void sim_delay(double seconds);
+
+// Runs virtual time up to the given time, executing motion and receiving bytes as they come due
+void sim_run_until(double time);
+
+// The serial line: bytes come in at the baud rate while there is room in the receive buffer
+void sim_serial_open(const char *data, long size, long baud);
+double sim_serial_next_arrival();   // When the next byte arrives, INFINITY if none will
+void sim_serial_arrive();           // Puts the next byte in the receive buffer
+int sim_serial_done();              // TRUE when every byte has been received and read
+extern double sim_serial_done_time; // When the last byte was read
+extern long sim_lines_answered;     // The number of 'ok' and 'error' responses sent
+extern long sim_errors;             // The number of 'error' responses sent
+extern int sim_echo;                // Print the output of Grbl when TRUE
+extern double sim_line_time;        // Seconds of virtual time charged for executing each line
+
+#endif
@@ -0,0 +1,358 @@
+/*
+  trapezoid.c - runs the real planner and stepper on the PC and logs the velocity they produce
+  Part of Grbl
+
+  Copyright (c) 2009-2011 Simen Svale Skogsrud
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The G-code is executed line by line by the real parser, motion control and planner, and the blocks
+   by stepper.c itself: timer 1 and timer 2 are counted in CPU cycles and The Stepper Driver Interrupt
+   and The Acceleration Tick Interrupt are called when they come due. The handlers take no time, so
+   the step timing is what the timer settings ask for, without the jitter of the real interrupts.
+
+   stepper.c is included rather than linked to read the state of the trapezoid generator. The velocity
+   is written to stdout as CSV, one row per acceleration tick or, with -s, one row per step event. The
+   totals go to stderr: the steps planned and put out per axis and the largest deviations of the rates
+   actually run from the rates planned. The exit status is 1 when steps went missing or a block left 
+   faster than its final_rate allows, as the next block would then begin above its entry speed. */
+
+#include "../stepper.c"
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "gcode.h"
+
+#define NEVER UINT64_MAX
+#define RATE(cycles) (60.0*F_CPU/(cycles)) // Steps per minute at the given cycles per step event
+#define FINAL_RATE_TOLERANCE 5.0           // Percent above final_rate a block may leave at
+
+typedef struct {
+  block_t plan;              // The block as The Stepper Driver Interrupt began it
+  int32_t steps[3];          // The steps put out per axis, negative ones subtracted
+  uint32_t events;           // The step events put out
+  uint64_t first_event;      // The cycle of the first step event
+  uint64_t last_event;       // The cycle of the last step event
+  double initial_rate;       // The rates run, measured between the step events of the block
+  double peak_rate;
+  double final_rate;
+  double last_rate;          // The rate up to the last step, which the next block already times
+} block_record_t;
+
+double sim_time;
+
+static uint64_t cycle;             // CPU cycles since power up
+static uint64_t previous_event;    // The cycle of the previous step event, NEVER before the first
+static int32_t position[3];        // In steps
+static block_record_t *records;    // Every block begun so far
+static long record_count, record_capacity;
+static long pending_record = -1;   // The block the step bits waiting in out_bits belong to
+static int log_step_events;        // One row per step event rather than per acceleration tick
+static int motion_logged;          // Whether the last tick logged was one with a block running
+
+static uint16_t timer1_prescaler()
+{
+  static const uint16_t prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  return(prescaler[TCCR1B & 0x07]);
+}
+
+// The cycle The Stepper Driver Interrupt comes due. In CTC mode timer 1 counts up to OCR1A and starts
+// over from 0 on the next count, on every multiple of the prescaler. A count past OCR1A goes all the
+// way around first.
+static uint64_t next_step_event()
+{
+  uint16_t prescaler = timer1_prescaler();
+  if (!(TIMSK1 & (1<<OCIE1A)) || !prescaler) { return(NEVER); }
+  uint32_t counts = (TCNT1 <= OCR1A) ? OCR1A+1-TCNT1 : 0x10000L-TCNT1+OCR1A+1;
+  return((cycle/prescaler+counts)*prescaler);
+}
+
+static uint64_t next_timer2_overflow()
+{
+  if (!(TIMSK2 & (1<<TOIE2))) { return(NEVER); }
+  return((cycle/CYCLES_PER_TIMER2_OVERFLOW+1)*CYCLES_PER_TIMER2_OVERFLOW);
+}
+
+// Lets timer 1 count on to the given cycle
+static void advance_timer1(uint64_t to)
+{
+  uint16_t prescaler = timer1_prescaler();
+  if (!prescaler) { return; }
+  uint64_t counts = to/prescaler-cycle/prescaler;
+  if (TCNT1 > OCR1A) {
+    if (counts < 0x10000L-TCNT1) {
+      TCNT1 += counts;
+      return;
+    }
+    counts -= 0x10000L-TCNT1;
+    TCNT1 = 0;
+  }
+  TCNT1 = (TCNT1+counts) % (OCR1A+1L);
+}
+
+static block_record_t *new_record(block_t *block)
+{
+  if (record_count == record_capacity) {
+    record_capacity = record_capacity ? 2*record_capacity : 1024;
+    records = realloc(records, record_capacity*sizeof(block_record_t));
+  }
+  block_record_t *record = &records[record_count++];
+  memset(record, 0, sizeof(block_record_t));
+  record->plan = *block;
+  return(record);
+}
+
+// Accounts for the step bits put out at the given cycle
+static void log_steps(uint8_t bits, uint64_t at)
+{
+  static const uint8_t step_bit[3] = {1<<X_STEP_BIT, 1<<Y_STEP_BIT, 1<<Z_STEP_BIT};
+  static const uint8_t direction_bit[3] = {1<<X_DIRECTION_BIT, 1<<Y_DIRECTION_BIT, 1<<Z_DIRECTION_BIT};
+  block_record_t *record = &records[pending_record];
+  uint8_t axis;
+  bits ^= settings.invert_mask;
+  for(axis=0; axis<3; axis++) {
+    if (!(bits & step_bit[axis])) { continue; }
+    int direction = (bits & direction_bit[axis]) ? -1 : 1;
+    record->steps[axis] += direction;
+    position[axis] += direction;
+  }
+  double rate = (previous_event != NEVER) ? RATE(at-previous_event) : 0;
+  if (record->events) {
+    double block_rate = RATE(at-record->last_event);
+    if (record->events == 1) { record->initial_rate = block_rate; }
+    record->peak_rate = max(record->peak_rate, block_rate);
+    record->final_rate = record->last_rate;
+    record->last_rate = block_rate;
+  } else {
+    record->first_event = at;
+  }
+  record->events++;
+  record->last_event = at;
+  previous_event = at;
+  if (log_step_events) {
+    printf("%llu,%.6f,%ld,%u,%d,%d,%d,%.1f\n", (unsigned long long)at, (double)at/F_CPU, pending_record,
+      record->events, position[X_AXIS], position[Y_AXIS], position[Z_AXIS], rate);
+  }
+}
+
+// Runs The Stepper Driver Interrupt. It puts out the step bits it prepared the time before, after the
+// direction setup time when the direction changes, prepares the next and begins a new block once the
+// current one is done.
+static void step_event()
+{
+  uint8_t bits = out_bits;
+  uint64_t at = cycle;
+  if (settings.direction_setup_microseconds && ((STEPPING_PORT ^ out_bits) & DIRECTION_MASK)) {
+    at += (settings.direction_setup_microseconds*TICKS_PER_MICROSECOND)/8*8;
+  }
+  long traced = current_block ? record_count-1 : -1;
+  uint8_t sequence = block_sequence;
+  TIMER1_COMPA_vect();
+  if ((pending_record >= 0) && ((bits ^ settings.invert_mask) & STEP_MASK)) { log_steps(bits, at); }
+  if (block_sequence != sequence) { new_record(current_block); }
+  pending_record = traced;
+}
+
+// Runs The Acceleration Tick Interrupt and logs the rate if it ticked the trapezoid generator
+static void timer2_overflow()
+{
+  uint32_t counter = trapezoid_tick_cycle_counter;
+  TIMER2_OVF_vect();
+  if (log_step_events || (trapezoid_tick_cycle_counter > counter)) { return; }
+  if (current_block) {
+    uint32_t timer_cycles = (OCR1A+1L)*timer1_prescaler();
+    printf("%llu,%.6f,%ld,%u,%u,%.1f,%.3f\n", (unsigned long long)cycle, (double)cycle/F_CPU, record_count-1,
+      step_events_completed, trapezoid_adjusted_rate, RATE(timer_cycles),
+      RATE(timer_cycles)*current_block->millimeters/current_block->step_event_count);
+    motion_logged = TRUE;
+  } else if (motion_logged) {
+    // Once at rest, so that plots come down to zero
+    printf("%llu,%.6f,-1,0,0,0.0,0.000\n", (unsigned long long)cycle, (double)cycle/F_CPU);
+    motion_logged = FALSE;
+  }
+}
+
+// Runs the timers up to the given cycle, calling the interrupts as they come due. Timer 2 comes first
+// when both are due, as its vector has the higher priority.
+static void run_until(uint64_t until)
+{
+  for(;;) {
+    uint64_t step_due = next_step_event();
+    uint64_t overflow_due = next_timer2_overflow();
+    uint64_t next = min(step_due, overflow_due);
+    if ((next > until) || (next == NEVER)) { break; }
+    advance_timer1(next);
+    cycle = next;
+    sim_time = (double)cycle/F_CPU;
+    if (overflow_due == next) { timer2_overflow(); }
+    if (step_due == next) { step_event(); }
+  }
+  if (until == NEVER) { return; }
+  advance_timer1(until);
+  cycle = until;
+  sim_time = (double)cycle/F_CPU;
+}
+
+void sim_run_until(double time)
+{
+  run_until(max(time*F_CPU, cycle));
+}
+
+void sim_delay(double seconds)
+{
+  run_until(cycle+(uint64_t)(seconds*F_CPU));
+}
+
+void sim_sleep()
+{
+  run_until(min(next_step_event(), next_timer2_overflow()));
+}
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: trapezoid [options] gcode-file ('-' reads stdin) > velocity.csv\n"
+    "  -b file   Write the blocks, planned and as run, to file as CSV\n"
+    "  -s        Write one row per step event instead of one per acceleration tick\n");
+  exit(2);
+}
+
+static void write_blocks(FILE *file)
+{
+  long i;
+  fprintf(file, "block,step_event_count,steps_x,steps_y,steps_z,run_x,run_y,run_z,nominal_rate,"
+    "initial_rate,run_initial_rate,peak_rate,run_peak_rate,final_rate,run_final_rate,accelerate_until,"
+    "decelerate_after,start,duration\n");
+  for(i=0; i<record_count; i++) {
+    block_record_t *record = &records[i];
+    block_t *block = &record->plan;
+    fprintf(file, "%ld,%u,%d,%d,%d,%d,%d,%d,%u,%u,%.1f,%u,%.1f,%u,%.1f,%u,%u,%.6f,%.6f\n", i,
+      block->step_event_count,
+      (block->direction_bits & (1<<X_DIRECTION_BIT)) ? -(int32_t)block->steps_x : (int32_t)block->steps_x,
+      (block->direction_bits & (1<<Y_DIRECTION_BIT)) ? -(int32_t)block->steps_y : (int32_t)block->steps_y,
+      (block->direction_bits & (1<<Z_DIRECTION_BIT)) ? -(int32_t)block->steps_z : (int32_t)block->steps_z,
+      record->steps[X_AXIS], record->steps[Y_AXIS], record->steps[Z_AXIS], block->nominal_rate,
+      block->initial_rate, record->initial_rate, block->peak_rate, record->peak_rate, 
+      block->final_rate,
+      record->final_rate, block->accelerate_until, block->decelerate_after,
+      (double)record->first_event/F_CPU, (double)(record->last_event-record->first_event)/F_CPU);
+  }
+}
+
+// The largest relative deviation of a run rate from the planned rate, in percent
+static double rate_error(double run, double planned, double worst)
+{
+  if (!planned || !run) { return(worst); }
+  double error = 100.0*(run-planned)/planned;
+  return((fabs(error) > fabs(worst)) ? error : worst);
+}
+
+int main(int argc, char **argv)
+{
+  FILE *blocks_file = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "b:s")) != -1) {
+    switch (option) {
+      case 'b':
+      if (!(blocks_file = fopen(optarg, "w"))) {
+        perror(optarg);
+        return(1);
+      }
+      break;
+      case 's': log_step_events = TRUE; break;
+      default: usage();
+    }
+  }
+  if (optind != argc-1) { usage(); }
+  long size;
+  char *data = sim_read_file(argv[optind], &size);
+  if (!data) {
+    perror(argv[optind]);
+    return(1);
+  }
+
+  PINB = 0xff; // The limit switches are open
+  settings_init();
+  plan_init();
+  st_init();
+  spindle_init();
+  gc_init();
+  previous_event = NEVER;
+  if (log_step_events) {
+    printf("cycle,time,block,step_event,x,y,z,rate\n");
+  } else {
+    printf("cycle,time,block,step_events_completed,rate,timer_rate,speed\n");
+  }
+
+  // Execute the lines as sp_process() would
+  char line[256];
+  long i, line_number = 1, errors = 0;
+  int length = 0;
+  for(i=0; i<=size; i++) {
+    char c = (i < size) ? data[i] : '\n';
+    if ((c == '\n') || (c == '\r')) {
+      if (length) {
+        line[length] = 0;
+        uint8_t status = gc_execute_line(line);
+        if (status != GCSTATUS_OK) {
+          fprintf(stderr, "Line %ld: error %d\n", line_number, status);
+          errors++;
+        }
+        length = 0;
+      }
+      if (c == '\n') { line_number++; }
+    } else if ((c > ' ') && (length < sizeof(line)-1)) {
+      line[length++] = ((c >= 'a') && (c <= 'z')) ? c-'a'+'A' : c;
+    }
+  }
+  // The last step bits go out with the step event that finds the buffer empty
+  st_synchronize();
+  while (TIMSK1 & (1<<OCIE1A)) { sim_sleep(); }
+  while (motion_logged) { sim_sleep(); }
+
+  int32_t planned[3] = {0, 0, 0};
+  uint64_t step_events = 0;
+  double initial_error = 0, peak_error = 0, final_error = 0;
+  long fast_exits = 0;
+  for(i=0; i<record_count; i++) {
+    block_t *block = &records[i].plan;
+    planned[X_AXIS] += (block->direction_bits & (1<<X_DIRECTION_BIT)) ? -(int32_t)block->steps_x : block->steps_x;
+    planned[Y_AXIS] += (block->direction_bits & (1<<Y_DIRECTION_BIT)) ? -(int32_t)block->steps_y : block->steps_y;
+    planned[Z_AXIS] += (block->direction_bits & (1<<Z_DIRECTION_BIT)) ? -(int32_t)block->steps_z : block->steps_z;
+    step_events += records[i].events;
+    initial_error = rate_error(records[i].initial_rate, block->initial_rate, initial_error);
+    peak_error = rate_error(records[i].peak_rate, block->peak_rate, peak_error);
+    final_error = rate_error(records[i].final_rate, block->final_rate, final_error);
+    if (records[i].final_rate > block->final_rate*(1+FINAL_RATE_TOLERANCE/100)) {
+      fprintf(stderr, "Block %ld left at %.1f steps/min, planned %u\n", i, records[i].final_rate, 
+        block->final_rate);
+      fast_exits++;
+    }
+  }
+  if (blocks_file) {
+    write_blocks(blocks_file);
+    fclose(blocks_file);
+  }
+  uint64_t motion = step_events ? previous_event-records[0].first_event : 0;
+  fprintf(stderr, "%ld blocks, %llu step events in %.6f s (%llu cycles) of motion\n", record_count,
+    (unsigned long long)step_events, (double)motion/F_CPU, (unsigned long long)motion);
+  fprintf(stderr, "Steps planned: X %d, Y %d, Z %d\n", planned[X_AXIS], planned[Y_AXIS], planned[Z_AXIS]);
+  fprintf(stderr, "Steps run:     X %d, Y %d, Z %d\n", position[X_AXIS], position[Y_AXIS], position[Z_AXIS]);
+  fprintf(stderr, "Largest rate deviation from the plan: initial %+.2f%%, peak %+.2f%%, final %+.2f%%\n",
+    initial_error, peak_error, final_error);
+  if (errors) { fprintf(stderr, "%ld lines failed\n", errors); }
+  if (fast_exits) { fprintf(stderr, "%ld blocks left above their final rate\n", fast_exits); }
+  return((errors || fast_exits || memcmp(planned, position, sizeof(position))) ? 1 : 0);
+}
@@ -0,0 +1,12 @@
+// Host stand-in for the avr-libc CRC routines in use
+#ifndef sim_util_crc16_h
+#define sim_util_crc16_h
+#include <inttypes.h>
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+  uint8_t i;
+  crc ^= data;
+  for(i=0; i<8; i++) { crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1); }
+  return(crc);
+}
+#endif
@@ -0,0 +1,6 @@
+// Host stand-in: delays pass in virtual time
+#ifndef sim_util_delay_h
+#define sim_util_delay_h
+#define _delay_ms(ms) sim_delay((ms)/1000.0)
+#define _delay_us(us) sim_delay((us)/1000000.0)
+#endif
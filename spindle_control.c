@@ -21,25 +21,128 @@
 #include "spindle_control.h"
 #include "settings.h"
 #include "config.h"
+#include "planner.h"
+#include "stepper.h"
+#include "nuts_bolts.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <math.h>
+
+static int current_direction; // The direction the spindle is running in. 0 when stopped.
+
+#ifdef SPINDLE_RPM_TABLE
+typedef struct {
+  uint16_t rpm;
+  uint8_t pwm;
+} spindle_rpm_map_t;
+static const spindle_rpm_map_t spindle_rpm_map[] PROGMEM = SPINDLE_RPM_TABLE;
+#define SPINDLE_RPM_MAP_SIZE (sizeof(spindle_rpm_map)/sizeof(spindle_rpm_map_t))
+#endif
 
 void spindle_init()
 {
   SPINDLE_ENABLE_DDR |= 1<<SPINDLE_ENABLE_BIT;
+  SPINDLE_DIRECTION_DDR |= 1<<SPINDLE_DIRECTION_BIT;
+#ifdef VARIABLE_SPINDLE
+  // Timer 2 in fast PWM mode. The output compare pin is only connected while the spindle runs.
+  TCCR2A = (1<<WGM21)|(1<<WGM20);
+  TCCR2B = (1<<CS22); // 1/64 prescaler, ~1kHz PWM. The stepper times its acceleration ticks by the overflows.
+  OCR2A = 0;
+#endif
+  spindle_set_pwm(0);
 }
 
-void spindle_run(int direction, uint32_t rpm) 
+#ifdef SPINDLE_RPM_TABLE
+// Interpolates the duty between the two table entries surrounding rpm
+uint8_t spindle_rpm_to_pwm(uint32_t rpm)
+{
+  if (rpm == 0) { return(0); }
+  uint8_t i;
+  uint16_t rpm_0 = pgm_read_word(&spindle_rpm_map[0].rpm);
+  uint8_t pwm_0 = pgm_read_byte(&spindle_rpm_map[0].pwm);
+  if (rpm <= rpm_0) { return(max(pwm_0, 1)); }
+  for(i=1; i<SPINDLE_RPM_MAP_SIZE; i++) {
+    uint16_t rpm_1 = pgm_read_word(&spindle_rpm_map[i].rpm);
+    uint8_t pwm_1 = pgm_read_byte(&spindle_rpm_map[i].pwm);
+    if (rpm <= rpm_1) {
+      return(max(pwm_0 + ((int32_t)(pwm_1-pwm_0)*(int32_t)(rpm-rpm_0))/(int32_t)(rpm_1-rpm_0), 1));
+    }
+    rpm_0 = rpm_1;
+    pwm_0 = pwm_1;
+  }
+  return(pwm_0);
+}
+#else
+// Maps settings.spindle_min_rpm..settings.spindle_max_rpm linearly to the duty range 1..255
+uint8_t spindle_rpm_to_pwm(uint32_t rpm)
 {
-  if(direction >= 0) {
-    SPINDLE_DIRECTION_PORT &= ~(1<<SPINDLE_DIRECTION_BIT);
+  if (rpm == 0) { return(0); }
+  if (rpm <= settings.spindle_min_rpm) { return(1); }
+  if (rpm >= settings.spindle_max_rpm) { return(255); }
+  return(1 + lround(254.0*(rpm-settings.spindle_min_rpm)/(settings.spindle_max_rpm-settings.spindle_min_rpm)));
+}
+#endif
+
+void spindle_set_pwm(uint8_t pwm)
+{
+#ifdef VARIABLE_SPINDLE
+  // Called from the main program and from the stepper interrupts, so the read-modify-writes of the
+  // registers must not be interrupted
+  uint8_t sreg = SREG;
+  cli();
+  if (pwm) {
+    OCR2A = pwm;
+    TCCR2A |= (1<<COM2A1); // Connect OC2A, non-inverting
   } else {
-    SPINDLE_DIRECTION_PORT |= 1<<SPINDLE_DIRECTION_BIT;
+    TCCR2A &= ~(1<<COM2A1); // Disconnect OC2A and hold the pin low
+    SPINDLE_ENABLE_PORT &= ~(1<<SPINDLE_ENABLE_BIT);
   }
-  SPINDLE_ENABLE_PORT |= 1<<SPINDLE_ENABLE_BIT;
+  SREG = sreg;
+#endif
+}
+
+void spindle_run(int direction, uint32_t rpm) 
+{
+  uint8_t laser_mode = bit_istrue(settings.flags, BITFLAG_LASER_MODE);
+  // The PWM pin doubles as the enable, so M3/M4 without an S word run the spindle at full speed as they 
+  // did before the speed control. A laser without power does not fire.
+  uint8_t pwm = (rpm || laser_mode) ? spindle_rpm_to_pwm(rpm) : 255;
+  if (direction != current_direction) {
+    // Let the tool finish what it is doing before starting, stopping or reversing the spindle. A laser
+    // switches instantly, so in laser mode M3/M4 just take effect with the next block.
+    if (!laser_mode) { st_synchronize(); }
+    if(direction >= 0) {
+      SPINDLE_DIRECTION_PORT &= ~(1<<SPINDLE_DIRECTION_BIT);
+    } else {
+      SPINDLE_DIRECTION_PORT |= 1<<SPINDLE_DIRECTION_BIT;
+    }
+#ifndef VARIABLE_SPINDLE
+    SPINDLE_ENABLE_PORT |= 1<<SPINDLE_ENABLE_BIT;
+#endif
+    current_direction = direction;
+  }
+  // Queue the speed with the upcoming blocks. If nothing is buffered there is no block to carry it, so
+  // apply it right away. (Stamp first, then check: the stepper applies the stamped value if it
+  // runs dry in between.) A laser only fires while moving, so it always waits for the next block.
+  plan_set_spindle_pwm(pwm);
+  if (!laser_mode && !plan_get_current_block()) { spindle_set_pwm(pwm); }
 }
 
 void spindle_stop()
 {
+  if (bit_istrue(settings.flags, BITFLAG_LASER_MODE)) {
+    // Blocks already buffered keep their power, the following blocks run dark
+    current_direction = 0;
+    plan_set_spindle_pwm(0);
+    return;
+  }
+  if (current_direction) { st_synchronize(); }
+  current_direction = 0;
+  plan_set_spindle_pwm(0);
+  spindle_set_pwm(0);
+#ifndef VARIABLE_SPINDLE
   SPINDLE_ENABLE_PORT &= ~(1<<SPINDLE_ENABLE_BIT);
+#endif
 }
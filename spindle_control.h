@@ -24,7 +24,17 @@
 #include <avr/io.h>
 
 void spindle_init();
+
+// Runs the spindle in the given direction (1 = cw, -1 = ccw) at the given RPM. Starting, stopping 
+// and reversing wait for buffered motion to complete. Speed changes are queued with the motion so 
+// they take effect when the next buffered block starts.
 void spindle_run(int direction, uint32_t rpm);
 void spindle_stop();
 
+// Converts an RPM to the PWM duty (0-255) of the spindle speed signal. 0 means stopped.
+uint8_t spindle_rpm_to_pwm(uint32_t rpm);
+
+// Sets the PWM duty of the spindle speed signal right away. Called by the stepper as blocks start.
+void spindle_set_pwm(uint8_t pwm);
+
 #endif
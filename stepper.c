@@ -29,8 +29,11 @@
 #include <util/delay.h>
 #include "nuts_bolts.h"
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "planner.h"
 #include "wiring_serial.h"
+#include "spindle_control.h"
+#include "profile.h"
 
 
 // Some useful constants
@@ -41,8 +44,22 @@
 
 #define TICKS_PER_MICROSECOND (F_CPU/1000000)
 #define CYCLES_PER_ACCELERATION_TICK ((TICKS_PER_MICROSECOND*1000000)/ACCELERATION_TICKS_PER_SECOND)
+#define CYCLES_PER_TIMER2_OVERFLOW (64L*256L) // Timer 2 overflows every 256 counts at the 1/64 prescaler
+#define CYCLES_PER_RATE_UPDATE ((TICKS_PER_MICROSECOND*1000000)/RATE_UPDATES_PER_SECOND)
 
 #define MINIMUM_STEPS_PER_MINUTE 1200 // The stepper subsystem will never run slower than this, exept when sleeping
+#define HOMING_SEARCH_TRAVEL 1.5 // The homing cycle gives up on a switch after this many times the travel of the axis
+
+// Reciprocal table used by set_step_events_per_minute() to get from a rate to the cycles between step events
+// without a 32-bit division. Entry i holds the cycles per step event at a rate of 64+i steps per minute.
+#define CYCLES_PER_MINUTE (TICKS_PER_MICROSECOND*1000000L*60L)
+#define RECIPROCAL(i) (CYCLES_PER_MINUTE/(64+(i)))
+#define RECIPROCAL_ROW(i) RECIPROCAL(i), RECIPROCAL(i+1), RECIPROCAL(i+2), RECIPROCAL(i+3), \
+  RECIPROCAL(i+4), RECIPROCAL(i+5), RECIPROCAL(i+6), RECIPROCAL(i+7)
+static const uint32_t cycles_per_step_table[65] PROGMEM = {
+  RECIPROCAL_ROW(0), RECIPROCAL_ROW(8), RECIPROCAL_ROW(16), RECIPROCAL_ROW(24), 
+  RECIPROCAL_ROW(32), RECIPROCAL_ROW(40), RECIPROCAL_ROW(48), RECIPROCAL_ROW(56), RECIPROCAL(64)
+};
 
 #define ENABLE_STEPPER_DRIVER_INTERRUPT()  TIMSK1 |= (1<<OCIE1A)
 #define DISABLE_STEPPER_DRIVER_INTERRUPT() TIMSK1 &= ~(1<<OCIE1A)
@@ -55,13 +72,34 @@ static int32_t counter_x,       // Counter variables for the bresenham line trac
                counter_y, 
                counter_z;       
 static uint32_t step_events_completed; // The number of step events executed in the current block
-static volatile int busy; // TRUE when SIG_OUTPUT_COMPARE1A is being serviced. Used to avoid retriggering that handler.
+static volatile uint8_t block_sequence; // Counts the blocks begun. Tells the trapezoid generator a new block began.
+static volatile uint32_t block_initial_rate; // The initial_rate of the block begun last, as it was when it began
+static volatile uint16_t step_overruns; // The step events that came due before the previous one was done
+static volatile uint8_t idle_countdown; // Timer 2 overflows (~1ms) left until the drivers are disabled, 0 when not counting
+#ifndef STEP_PULSE_DELAY_AND_CLEAR
+static volatile uint8_t deferred_step_bits; // The stepping bits The Deferred Step Interrupt is to output
+#endif
+static volatile uint8_t alarm; // The ALARM_* reason once the position is lost. Only a reset gets us out of here.
+#ifdef PROFILE
+static volatile uint8_t stop_requested; // TRUE when st_synchronize() let the buffer run empty on purpose
+#endif
 
 // Variables used by the trapezoid generation
-static uint32_t cycles_per_step_event;        // The number of machine cycles between each step event
-static uint32_t trapezoid_tick_cycle_counter; // The cycles since last trapezoid_tick. Used to generate ticks at a steady
-                                              // pace without allocating a separate timer
+static uint32_t trapezoid_tick_cycle_counter; // The cycles since last trapezoid_tick. Counted up by the
+                                              // overflows of timer 2.
+static uint8_t trapezoid_sequence;            // The block_sequence of the block the generator is working on
 static uint32_t trapezoid_adjusted_rate;      // The current rate of step_events according to the trapezoid generator
+static uint32_t trapezoid_rate_delta;         // The current change of rate per tick. Ramped by jerk_delta on S-curves.
+static uint8_t trapezoid_decelerating;        // TRUE once the generator entered the deceleration of the current block
+
+// The ramp from the rate of the last tick to that of the next one, followed by The Stepper Driver Interrupt
+static uint32_t step_event_cycles;            // The cycles per step event timer 1 is set to
+static uint32_t ramp_rate;                    // The rate set at the last tick
+static uint32_t ramp_end_rate;                // Where the ramp ends, no further than the next tick
+static int32_t ramp_slope;                    // The change of rate per 256 cycles, times 256. Zero when flat.
+static uint32_t ramp_cycles;                  // The cycles since the last tick, counted off by the step events
+static uint32_t ramp_updated;                 // ramp_cycles when the rate was last updated
+static volatile uint8_t ramp_sequence;        // Counts the ramps set. Tells update_rate() a tick came in between.
 
 //         __________________________
 //        /|                        |\     _________________         ^
@@ -78,91 +116,283 @@ static uint32_t trapezoid_adjusted_rate;      // The current rate of step_events
 //  during the first block->accelerate_until step_events_completed, then keeps going at constant speed until 
 //  step_events_completed reaches block->decelerate_after after which it decelerates until the trapezoid generator is reset.
 //  The slope of acceleration is always +/- block->rate_delta and is applied at a constant rate by trapezoid_generator_tick()
-//  that is called ACCELERATION_TICKS_PER_SECOND times per second.
+//  that is called ACCELERATION_TICKS_PER_SECOND times per second. Each tick sets the new rate and a ramp on to
+//  the rate of the next tick at the same slope, which The Stepper Driver Interrupt follows step by step.
+//
+//  When a jerk limit is set the corners of the trapezoid are rounded into S-curves: the rate_delta applied
+//  by each tick starts at zero, grows by block->jerk_delta per tick up to block->rate_delta, and shrinks
+//  again as the rate closes in on block->peak_rate or block->final_rate.
 
 void set_step_events_per_minute(uint32_t steps_per_minute);
+uint32_t cycles_per_step_event(uint32_t steps_per_minute);
+uint32_t config_step_timer(uint32_t cycles);
+
+// Stops the idle countdown. If the drivers were already disabled, powers them up and lets them settle.
+static void steppers_enable() {
+  cli();
+  idle_countdown = 0;
+  if (!(STEPPERS_ENABLE_PORT & (1<<STEPPERS_ENABLE_BIT))) {
+    STEPPERS_ENABLE_PORT |= 1<<STEPPERS_ENABLE_BIT;
+    sei();
+    delay_ms(STEPPERS_ENABLE_DELAY);
+  }
+  sei();
+}
 
 void st_wake_up() {
+  if (alarm) { return; }
+#ifdef PROFILE
+  stop_requested = FALSE; // Motion goes on, the stepper never stopped
+#endif
+  steppers_enable();
   ENABLE_STEPPER_DRIVER_INTERRUPT();  
 }
 
-// Initializes the trapezoid generator from the current block. Called whenever a new 
-// block begins.
-inline void trapezoid_generator_reset() {
-  trapezoid_adjusted_rate = current_block->initial_rate;  
-  trapezoid_tick_cycle_counter = 0; // Always start a new trapezoid with a full acceleration tick
-  set_step_events_per_minute(trapezoid_adjusted_rate);
+// Starts the countdown to disabling the drivers once the steppers have come to rest
+static void st_idle() {
+  if (settings.stepper_idle_lock_time != 255) {
+    idle_countdown = max(settings.stepper_idle_lock_time, 1);
+  }
+}
+
+uint8_t st_alarm() {
+  return(alarm);
+}
+
+uint16_t st_overruns() {
+  cli();
+  uint16_t overruns = step_overruns;
+  sei();
+  return(overruns);
+}
+
+// Drops the current block and everything planned after it
+static void flush_motion() {
+  current_block = NULL;
+  plan_flush();
+}
+
+// In laser mode the power of the laser is scaled by the ratio of the current to the nominal rate. This
+// keeps the energy delivered per millimeter constant while the block accelerates and decelerates.
+inline uint8_t laser_power(block_t *block, uint32_t rate) {
+  return((block->spindle_pwm*rate)/block->nominal_rate);
+}
+
+// Returns the change of rate for the next tick when the rate is still remaining steps/minute away from 
+// where the current ramp ends. On trapezoids that is simply rate_delta. On S-curves the change of rate 
+// grows by jerk_delta each tick and is wound back down once the remaining change of rate is about what 
+// it takes to do so, i.e. rate_delta*(ticks_to_wind_down-1)/2.
+inline uint32_t trapezoid_next_rate_delta(block_t *block, uint32_t remaining) {
+  int32_t jerk_delta = block->jerk_delta;
+  if (jerk_delta == 0) {
+    trapezoid_rate_delta = block->rate_delta;
+  } else {
+    uint32_t ticks_to_wind_down = trapezoid_rate_delta/jerk_delta;
+    if (ticks_to_wind_down > 1 && remaining/(ticks_to_wind_down-1) <= trapezoid_rate_delta/2) {
+      trapezoid_rate_delta -= jerk_delta;
+    } else if (trapezoid_rate_delta < block->rate_delta) {
+      trapezoid_rate_delta = min(trapezoid_rate_delta+jerk_delta, block->rate_delta);
+    }
+  }
+  return(min(trapezoid_rate_delta, remaining));
+}
+
+// Returns the highest rate for the next tick from which final_rate is still reached by the end of the block
+// at full deceleration. The wind-down of an S-curve only estimates its distance, so its deceleration is
+// clamped to this to make sure the block ends at final_rate.
+inline uint32_t trapezoid_braking_rate(block_t *block, uint32_t completed, uint32_t rate) {
+  int32_t remaining = block->step_event_count-completed-rate/(60*ACCELERATION_TICKS_PER_SECOND);
+  if (remaining <= 0) { return(block->final_rate); }
+  return(sqrt(square((double)block->final_rate)+
+    2.0*block->rate_delta*ACCELERATION_TICKS_PER_SECOND*60*remaining));
 }
 
-// This is called ACCELERATION_TICKS_PER_SECOND times per second by the step_event
-// interrupt. It can be assumed that the trapezoid-generator-parameters and the
-// current_block stays untouched by outside handlers for the duration of this function call.
+// This is called ACCELERATION_TICKS_PER_SECOND times per second by the acceleration tick interrupt with
+// interrupts enabled. The Stepper Driver Interrupt may begin a new block at any point, so the generator 
+// works on a snapshot of its state and only applies the new rate if the block is still the same. 
 inline void trapezoid_generator_tick() {     
-  if (current_block) {
-    if (step_events_completed < current_block->accelerate_until) {
-      trapezoid_adjusted_rate += current_block->rate_delta;
-      if (trapezoid_adjusted_rate > current_block->nominal_rate ) {
-        trapezoid_adjusted_rate = current_block->nominal_rate;
-      }
-      set_step_events_per_minute(trapezoid_adjusted_rate);
-    } else if (step_events_completed > current_block->decelerate_after) {
-      // NOTE: We will only reduce speed if the result will be > 0. This catches small
-      // rounding errors that might leave steps hanging after the last trapezoid tick.
-      if (trapezoid_adjusted_rate > current_block->rate_delta) {
-        trapezoid_adjusted_rate -= current_block->rate_delta;
-      }
-      if (trapezoid_adjusted_rate < current_block->final_rate) {
-        trapezoid_adjusted_rate = current_block->final_rate;
-      }        
-      set_step_events_per_minute(trapezoid_adjusted_rate);
-    } else {
-      // Make sure we cruise at exactly nominal rate
-      if (trapezoid_adjusted_rate != current_block->nominal_rate) {
-        trapezoid_adjusted_rate = current_block->nominal_rate;
-        set_step_events_per_minute(trapezoid_adjusted_rate);
+  cli();
+  block_t *block = current_block;
+  uint32_t completed = step_events_completed;
+  uint8_t sequence = block_sequence;
+  uint32_t initial_rate = block_initial_rate;
+  sei();
+  if (block == NULL) { return; }
+  if (sequence != trapezoid_sequence) {
+    // A new block began since the last tick, at the rate begin_next_block() set
+    trapezoid_sequence = sequence;
+    trapezoid_adjusted_rate = initial_rate;  
+    trapezoid_rate_delta = 0;
+    trapezoid_decelerating = FALSE;
+  }
+  uint32_t rate = trapezoid_adjusted_rate; // The rate of the last tick
+  
+  if (completed < block->accelerate_until) {
+    if (trapezoid_adjusted_rate < block->peak_rate) {
+      trapezoid_adjusted_rate += trapezoid_next_rate_delta(block, block->peak_rate-trapezoid_adjusted_rate);
+    }
+  } else if (completed > block->decelerate_after) {
+    if (!trapezoid_decelerating) {
+      trapezoid_decelerating = TRUE;
+      trapezoid_rate_delta = 0;
+    }
+    // NOTE: We never go below final_rate. This catches small rounding errors that might
+    // leave steps hanging after the last trapezoid tick.
+    if (trapezoid_adjusted_rate > block->final_rate) {
+      trapezoid_adjusted_rate -= trapezoid_next_rate_delta(block, trapezoid_adjusted_rate-block->final_rate);
+      if (block->jerk_delta) {
+        uint32_t braking_rate = trapezoid_braking_rate(block, completed, trapezoid_adjusted_rate);
+        if (trapezoid_adjusted_rate > braking_rate) {
+          trapezoid_adjusted_rate = max(braking_rate, block->final_rate);
+          trapezoid_rate_delta = min(rate-trapezoid_adjusted_rate, block->rate_delta);
+        }
       }
     }
+  } else {
+    // Make sure we cruise at exactly the peak rate
+    trapezoid_rate_delta = 0;
+    trapezoid_adjusted_rate = block->peak_rate;
+  }
+  
+  // Ramp on from the new rate at the same slope until the next tick, but not past peak_rate or final_rate. 
+  // Following the rate of the ticks rather than lagging behind it keeps the blocks ending at final_rate.
+  uint32_t end_rate = trapezoid_adjusted_rate;
+  if (trapezoid_adjusted_rate > rate) {
+    end_rate = min(trapezoid_adjusted_rate+(trapezoid_adjusted_rate-rate), block->peak_rate);
+  } else if (trapezoid_adjusted_rate < rate) {
+    end_rate = max(trapezoid_adjusted_rate-(rate-trapezoid_adjusted_rate), block->final_rate);
+  }
+  int32_t slope = ((int32_t)(end_rate-trapezoid_adjusted_rate)*256)/(CYCLES_PER_ACCELERATION_TICK/256);
+  uint8_t laser_mode = bit_istrue(settings.flags, BITFLAG_LASER_MODE);
+  uint8_t pwm = 0;
+  if (laser_mode) { pwm = laser_power(block, trapezoid_adjusted_rate); }
+  uint32_t cycles = cycles_per_step_event(trapezoid_adjusted_rate);
+  cli();
+  if (sequence == block_sequence && current_block != NULL) {
+    step_event_cycles = config_step_timer(cycles);
+    ramp_rate = trapezoid_adjusted_rate;
+    ramp_end_rate = end_rate;
+    ramp_slope = slope;
+    ramp_cycles = 0;
+    ramp_updated = 0;
+    ramp_sequence++;
+    if (laser_mode) { spindle_set_pwm(pwm); }
+  }
+  sei();
+}
+
+// Sets the rate the ramp of the last tick has reached. Called by The Stepper Driver Interrupt, which is 
+// masked while the rate is computed with interrupts enabled. Returns with interrupts disabled.
+static void update_rate() {
+  DISABLE_STEPPER_DRIVER_INTERRUPT();
+  uint8_t sequence = ramp_sequence;
+  uint32_t rate = ramp_rate+((ramp_slope*(int32_t)(ramp_cycles >> 8)) >> 8);
+  uint32_t end_rate = ramp_end_rate;
+  uint8_t rising = (ramp_slope > 0);
+  sei();
+  if (rising ? (rate > end_rate) : (rate < end_rate)) { rate = end_rate; }
+  uint32_t cycles = cycles_per_step_event(rate);
+  cli();
+  if (sequence == ramp_sequence && current_block != NULL) { step_event_cycles = config_step_timer(cycles); }
+  ENABLE_STEPPER_DRIVER_INTERRUPT();
+}
+
+// Discards the finished block and begins the next one in the buffer, or lets the steppers come to rest 
+// when there is none. Called by The Stepper Driver Interrupt when it has no block to trace. The work is 
+// done with interrupts enabled and The Stepper Driver Interrupt masked, so The Stepper Port Reset Interrupt
+// ends the step pulse on time meanwhile. Only the results are applied with interrupts disabled, as is
+// everything the trapezoid generator and the limit switch interrupt look at. Returns with interrupts disabled.
+static void begin_next_block(uint8_t finished) {
+  DISABLE_STEPPER_DRIVER_INTERRUPT();
+  sei();
+  if (finished) { plan_discard_current_block(); }
+  block_t *block = plan_get_current_block();
+  uint8_t laser_mode = bit_istrue(settings.flags, BITFLAG_LASER_MODE);
+  uint8_t pwm;
+  uint32_t cycles = 0;
+  uint32_t initial_rate = 0;
+  if (block != NULL) {
+    // The planner goes on recalculating the block while it runs. Its initial_rate is only good now.
+    initial_rate = block->initial_rate;
+    pwm = laser_mode ? laser_power(block, initial_rate) : block->spindle_pwm;
+    cycles = cycles_per_step_event(initial_rate);
+  } else {
+    // Catch up with spindle speed changes issued after the last block was buffered. A laser is 
+    // switched off whenever the tool stands still.
+    pwm = laser_mode ? 0 : plan_get_spindle_pwm();
+  }
+  cli();
+  if (alarm) { return; } // A hard limit dropped all motion meanwhile
+  if (block == NULL) {
+    // The last step of the finished block goes out with the next step event. Come to rest after that.
+    if (finished) { 
+      ENABLE_STEPPER_DRIVER_INTERRUPT(); 
+      return;
+    }
+    spindle_set_pwm(pwm);
+    st_idle();
+#ifdef PROFILE
+    if (!stop_requested) { profile_starved(); }
+    stop_requested = FALSE;
+#endif
+    return;
   }
+  spindle_set_pwm(pwm);
+  step_event_cycles = config_step_timer(cycles);
+  ramp_slope = 0; // Until the first tick of the block
+  current_block = block;
+  block_sequence++;
+  block_initial_rate = initial_rate;
+  counter_x = -(current_block->step_event_count >> 1);
+  counter_y = counter_x;
+  counter_z = counter_x;
+  step_events_completed = 0;
+  ENABLE_STEPPER_DRIVER_INTERRUPT();
 }
 
 // "The Stepper Driver Interrupt" - This timer interrupt is the workhorse of Grbl. It is  executed at the rate set with
-// config_step_timer. It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately. 
+// config_step_timer. It executes the blocks of the block_buffer by pulsing the stepper pins appropriately. 
 // It is supported by The Stepper Port Reset Interrupt which it uses to reset the stepper port after each pulse.
+// The pulse output and the line tracing run with interrupts disabled. Beginning the next block is left to 
+// begin_next_block() and following the speed ramps to update_rate(), which let the other interrupts in. 
+// The ramps themselves are set by The Acceleration Tick Interrupt. A step event that comes due before the previous one is done is served late
+// rather than dropped, and counted in step_overruns.
 SIGNAL(TIMER1_COMPA_vect)
 {        
-  // TODO: Check if the busy-flag can be eliminated by just disabeling this interrupt while we are in it
-  
-  if(busy){ return; } // The busy-flag is used to avoid reentering this interrupt
-  // Set the direction pins a cuple of nanoseconds before we step the steppers
+  // Set the direction pins a cuple of nanoseconds before we step the steppers. Drivers that need longer 
+  // get settings.direction_setup_microseconds, but only when the direction actually changes.
+  uint8_t direction_change = settings.direction_setup_microseconds && 
+    ((STEPPING_PORT ^ out_bits) & DIRECTION_MASK);
   STEPPING_PORT = (STEPPING_PORT & ~DIRECTION_MASK) | (out_bits & DIRECTION_MASK);
+#ifdef STEP_PULSE_DELAY_AND_CLEAR
+  if (direction_change) {
+    uint8_t setup_start = TCNT0;
+    uint8_t setup_length = (settings.direction_setup_microseconds*TICKS_PER_MICROSECOND)/8;
+    while ((uint8_t)(TCNT0-setup_start) < setup_length) { }
+  }
   // Then pulse the stepping pins
   STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | out_bits;
-  // Reset step pulse reset timer so that The Stepper Port Reset Interrupt can reset the signal after
-  // exactly settings.pulse_microseconds microseconds.  Clear the overflow flag to stop a queued
-  // interrupt from resetting the step pulse too soon.
-  TCNT2 = -(((settings.pulse_microseconds-2)*TICKS_PER_MICROSECOND)/8);
-  TIFR2 |= (1<<TOV2);
-
-  busy = TRUE;
-  sei(); // Re enable interrupts (normally disabled while inside an interrupt handler)
-         // ((We re-enable interrupts in order for SIG_OVERFLOW2 to be able to be triggered 
-         // at exactly the right time even if we occasionally spend a lot of time inside this handler.))
-    
-  // If there is no current block, attempt to pop one from the buffer
-  if (current_block == NULL) {
-    // Anything in the buffer?
-    current_block = plan_get_current_block();
-    if (current_block != NULL) {
-      trapezoid_generator_reset();
-      counter_x = -(current_block->step_event_count >> 1);
-      counter_y = counter_x;
-      counter_z = counter_x;
-      step_events_completed = 0;
-    } else {
-      DISABLE_STEPPER_DRIVER_INTERRUPT();
-    }    
-  } 
+  // Timer 0 runs freely. Note when the pulse began, the pulse is ended at the end of this handler.
+  uint8_t pulse_start = TCNT0;
+#else
+  if (direction_change) {
+    // Leave the pulse to The Deferred Step Interrupt once the direction setup time has passed
+    deferred_step_bits = out_bits;
+    OCR0A = TCNT0+(settings.direction_setup_microseconds*TICKS_PER_MICROSECOND)/8;
+    TIFR0 = (1<<OCF0A);
+    TIMSK0 |= (1<<OCIE0A);
+  } else {
+    // Then pulse the stepping pins
+    STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | out_bits;
+    // Reset step pulse reset timer so that The Stepper Port Reset Interrupt can reset the signal after
+    // exactly settings.pulse_microseconds microseconds.  Clear the overflow flag to stop a queued
+    // interrupt from resetting the step pulse too soon.
+    TCNT0 = -(((settings.pulse_microseconds-2)*TICKS_PER_MICROSECOND)/8);
+    TIFR0 = (1<<TOV0);
+  }
+#endif
 
+  uint8_t finished = FALSE;
   if (current_block != NULL) {
     out_bits = current_block->direction_bits;
     counter_x += current_block->steps_x;
@@ -184,33 +414,96 @@ SIGNAL(TIMER1_COMPA_vect)
     step_events_completed += 1;
     if (step_events_completed >= current_block->step_event_count) {
       current_block = NULL;
-      plan_discard_current_block();
+      finished = TRUE;
     }
   } else {
     out_bits = 0;
   }          
   out_bits ^= settings.invert_mask;
   
-  // In average this generates a trapezoid_generator_tick every CYCLES_PER_ACCELERATION_TICK by keeping track
-  // of the number of elapsed cycles. The code assumes that step_events occur significantly more often than
-  // trapezoid_generator_ticks as they well should. 
-  trapezoid_tick_cycle_counter += cycles_per_step_event;
-  if(trapezoid_tick_cycle_counter > CYCLES_PER_ACCELERATION_TICK) {
+#ifdef STEP_PULSE_DELAY_AND_CLEAR
+  // Wait out what remains of settings.pulse_microseconds, usually little or nothing, then reset the 
+  // stepping pins (leave the direction pins)
+  uint8_t pulse_length = (settings.pulse_microseconds*TICKS_PER_MICROSECOND)/8;
+  while ((uint8_t)(TCNT0-pulse_start) < pulse_length) { }
+  STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (settings.invert_mask & STEP_MASK); 
+#endif
+
+  if (current_block == NULL) { 
+    begin_next_block(finished); 
+  } else if (ramp_slope) {
+    ramp_cycles += step_event_cycles;
+    if (ramp_cycles-ramp_updated >= CYCLES_PER_RATE_UPDATE) {
+      ramp_updated = ramp_cycles;
+      update_rate();
+    }
+  }
+
+  // The compare match flag is cleared on entry. If it is set again the next step event is already late.
+  if (TIFR1 & (1<<OCF1A)) { step_overruns++; }
+}
+
+// "The Acceleration Tick Interrupt" - Timer 2 runs continuously (it doubles as the spindle PWM timer) and 
+// overflows about 976 times per second. The overflows are counted off into a trapezoid_generator_tick 
+// every CYCLES_PER_ACCELERATION_TICK on average, so the speed ramps keep their pace no matter how slowly
+// the steppers are stepping. The tick runs with interrupts enabled so it never holds up a step event. The 
+// overflow interrupt is masked meanwhile to keep it from reentering itself.
+SIGNAL(TIMER2_OVF_vect)
+{
+#ifdef PROFILE
+  profile_timer2_overflows++;
+#endif
+  // Disable the drivers once the steppers have been at rest for settings.stepper_idle_lock_time
+  if (idle_countdown) {
+    if (--idle_countdown == 0) { STEPPERS_ENABLE_PORT &= ~(1<<STEPPERS_ENABLE_BIT); }
+  }
+  trapezoid_tick_cycle_counter += CYCLES_PER_TIMER2_OVERFLOW;
+  if (trapezoid_tick_cycle_counter > CYCLES_PER_ACCELERATION_TICK) {
     trapezoid_tick_cycle_counter -= CYCLES_PER_ACCELERATION_TICK;
+    TIMSK2 &= ~(1<<TOIE2);
+    sei();
     trapezoid_generator_tick();
+    cli();
+    TIMSK2 |= (1<<TOIE2);
   }
-  
-  busy=FALSE;
 }
 
+#ifndef STEP_PULSE_DELAY_AND_CLEAR
 // This interrupt is set up by SIG_OUTPUT_COMPARE1A when it sets the motor port bits. It resets
 // the motor port after a short period (settings.pulse_microseconds) completing one step cycle.
-SIGNAL(TIMER2_OVF_vect)
+SIGNAL(TIMER0_OVF_vect)
 {
   // reset stepping pins (leave the direction pins)
   STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (settings.invert_mask & STEP_MASK); 
 }
 
+// "The Deferred Step Interrupt" - Set up by SIG_OUTPUT_COMPARE1A when the direction changes. Fires once the 
+// direction pins have been stable for settings.direction_setup_microseconds and outputs the step pulse 
+// The Stepper Driver Interrupt held back.
+SIGNAL(TIMER0_COMPA_vect)
+{
+  TIMSK0 &= ~(1<<OCIE0A);
+  STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (deferred_step_bits & STEP_MASK);
+  TCNT0 = -(((settings.pulse_microseconds-2)*TICKS_PER_MICROSECOND)/8);
+  TIFR0 = (1<<TOV0);
+}
+#endif
+
+// The Limit Switch Interrupt - Fires when any limit pin changes. If a switch has been triggered and hard limits 
+// are enabled it stops step output at once, drops all planned motion and locks the controller in the alarm 
+// state. Position is lost at this point, so only a reset will do.
+SIGNAL(PCINT0_vect)
+{
+  if (bit_istrue(settings.flags, BITFLAG_HARD_LIMIT_ENABLE) && ((LIMIT_PIN & LIMIT_MASK) != LIMIT_MASK)) {
+    DISABLE_STEPPER_DRIVER_INTERRUPT();
+    STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (settings.invert_mask & STEP_MASK);
+    spindle_set_pwm(0); // A laser goes dark at once
+    alarm = ALARM_HARD_LIMIT;
+    flush_motion();
+    spindle_stop();     // Without VARIABLE_SPINDLE only this releases the enable pin
+  }
+}
+
 // Initialize and start the stepper motor subsystem
 void st_init()
 {
@@ -218,6 +511,9 @@ void st_init()
   STEPPING_DDR   |= STEPPING_MASK;
   STEPPING_PORT = (STEPPING_PORT & ~STEPPING_MASK) | settings.invert_mask;
   LIMIT_DDR &= ~(LIMIT_MASK);
+  LIMIT_PORT |= (LIMIT_MASK); // Enable internal pull-up resistors. Switches pull the pins low.
+  LIMIT_PCMSK |= LIMIT_MASK;  // Watch the limit pins with The Limit Switch Interrupt
+  PCICR |= (1<<LIMIT_PCIE);
   STEPPERS_ENABLE_DDR |= 1<<STEPPERS_ENABLE_BIT;
   
 	// waveform generation = 0100 = CTC
@@ -230,10 +526,18 @@ void st_init()
 	TCCR1A &= ~(3<<COM1A0); 
 	TCCR1A &= ~(3<<COM1B0); 
 	
-	// Configure Timer 2
+	// Configure Timer 0
+  TCCR0A = 0;         // Normal operation
+  TCCR0B = (1<<CS01); // Full speed, 1/8 prescaler
+#ifndef STEP_PULSE_DELAY_AND_CLEAR
+  TIMSK0 |= (1<<TOIE0);      
+#endif
+  
+  // Configure Timer 2 to time the acceleration ticks. spindle_init() may switch it to PWM mode later
+  // but keeps the prescaler, and with it the overflow rate.
   TCCR2A = 0;         // Normal operation
-  TCCR2B = (1<<CS21); // Full speed, 1/8 prescaler
-  TIMSK2 |= (1<<TOIE2);      
+  TCCR2B = (1<<CS22); // 1/64 prescaler
+  TIMSK2 |= (1<<TOIE2);
   
   set_step_events_per_minute(6000);
   DISABLE_STEPPER_DRIVER_INTERRUPT();  
@@ -248,7 +552,10 @@ void st_init()
 // Block until all buffered steps are executed
 void st_synchronize()
 {
-  while(plan_get_current_block()) { sleep_mode(); }    
+#ifdef PROFILE
+  if (plan_get_current_block()) { stop_requested = TRUE; }
+#endif
+  while(plan_get_current_block() && !alarm) { sleep_mode(); }    
 }
 
 // Configures the prescaler and ceiling of timer 1 to produce the given rate as accurately as possible.
@@ -288,15 +595,130 @@ uint32_t config_step_timer(uint32_t cycles)
   TCCR1B = (TCCR1B & ~(0x07<<CS10)) | ((prescaler+1)<<CS10);
   // Set ceiling
   OCR1A = ceiling;
+  // The acceleration tick changes the rate between step events. When a faster rate puts the ceiling 
+  // below the count the timer already reached it would count all the way around before the next step
+  // event. Have it match on the next count instead.
+  if (TCNT1 >= ceiling) { TCNT1 = ceiling-1; }
   return(actual_cycles);
 }
 
-void set_step_events_per_minute(uint32_t steps_per_minute) {
+// Computes CYCLES_PER_MINUTE/steps_per_minute using shifts, a table lookup and one multiply. The rate is 
+// scaled by a power of two into [2^14,2^15), i.e. 64.0-128.0 in 8 bit fixed point. The reciprocal of that
+// is interpolated from cycles_per_step_table and scaled back. The interpolation and the low bits of fast
+// rates shifted out put the result within 1.3e-4 of the division (relative), plus the truncation to whole
+// cycles. That is up to 34 cycles at the slowest rates, a few counts of timer 1 where the prescaler is 8.
+uint32_t cycles_per_step_event(uint32_t steps_per_minute) {
   if (steps_per_minute < MINIMUM_STEPS_PER_MINUTE) { steps_per_minute = MINIMUM_STEPS_PER_MINUTE; }
-  cycles_per_step_event = config_step_timer((TICKS_PER_MICROSECOND*1000000*60)/steps_per_minute);
+  uint8_t shift = 8; // The result is divided by 2^shift in the end
+  while (steps_per_minute >= (1L<<15)) { steps_per_minute >>= 1; shift++; }
+  while (steps_per_minute < (1L<<14)) { steps_per_minute <<= 1; shift--; } // MINIMUM_STEPS_PER_MINUTE keeps shift > 0
+  uint8_t index = (steps_per_minute >> 8)-64;
+  uint8_t fraction = steps_per_minute & 0xff;
+  uint32_t cycles = pgm_read_dword(&cycles_per_step_table[index]);
+  cycles -= ((cycles-pgm_read_dword(&cycles_per_step_table[index+1]))*fraction) >> 8;
+  return(cycles >> shift);
+}
+
+void set_step_events_per_minute(uint32_t steps_per_minute) {
+  config_step_timer(cycles_per_step_event(steps_per_minute));
 }
 
+// Moves the axes in axes (a mask of *_LIMIT_BIT) at rate mm/min, toward their limit switches if approach 
+// is TRUE or away from them otherwise. If distance is non-zero every axis moves exactly that many 
+// millimeters. Otherwise every axis moves until its switch has been triggered (or released when moving 
+// away) for debounce_ms milliseconds. An axis holds still while its switch settles, the others go on.
+// Returns FALSE as soon as an axis has moved HOMING_SEARCH_TRAVEL times its travel without that happening.
+static uint8_t homing_move(uint8_t axes, uint8_t approach, double rate, double distance, uint16_t debounce_ms)
+{
+  static const uint8_t limit_bit[3] = {1<<X_LIMIT_BIT, 1<<Y_LIMIT_BIT, 1<<Z_LIMIT_BIT};
+  static const uint8_t step_bit[3] = {1<<X_STEP_BIT, 1<<Y_STEP_BIT, 1<<Z_STEP_BIT};
+  uint8_t axis;
+  uint32_t steps_left[3];
+  uint16_t counter[3], increment[3]; // Bresenham counters so that every axis moves at rate mm/min
+  uint16_t settled[3];               // The number of step periods the switch has been in the wanted state
+  
+  // Axes move toward their switches in the negative direction, unless inverted in homing_dir_mask
+  uint8_t direction_bits = (approach ? ~settings.homing_dir_mask : settings.homing_dir_mask) & DIRECTION_MASK;
+  
+  // One step event per period for the axis with the most steps/mm, proportionally fewer for the others
+  double max_steps_per_mm = max(settings.steps_per_mm[X_AXIS], 
+    max(settings.steps_per_mm[Y_AXIS], settings.steps_per_mm[Z_AXIS]));
+  uint32_t step_period = 60000000.0/(rate*max_steps_per_mm); // microseconds
+  if (step_period < 2*settings.pulse_microseconds) { step_period = 2*settings.pulse_microseconds; }
+  uint16_t settle_periods = (debounce_ms*1000L)/step_period;
+  for(axis=0; axis<3; axis++) {
+    counter[axis] = 0;
+    increment[axis] = lround(1000*settings.steps_per_mm[axis]/max_steps_per_mm);
+    steps_left[axis] = lround(((distance > 0) ? distance : HOMING_SEARCH_TRAVEL*settings.max_travel[axis])*
+      settings.steps_per_mm[axis]);
+    settled[axis] = 0;
+  }
+  
+  // Give the drivers their direction setup time before the first step
+  STEPPING_PORT = (STEPPING_PORT & ~DIRECTION_MASK) | ((direction_bits ^ settings.invert_mask) & DIRECTION_MASK);
+  delay_us(settings.direction_setup_microseconds);
+  
+  while(axes) {
+    uint8_t out_bits = direction_bits;
+    uint8_t limit_bits = LIMIT_PIN;
+    for(axis=0; axis<3; axis++) {
+      if (!(axes & limit_bit[axis])) { continue; }
+      if (distance == 0) {
+        uint8_t triggered = !(limit_bits & limit_bit[axis]);
+        if (triggered == approach) {
+          if (++settled[axis] > settle_periods) { axes &= ~limit_bit[axis]; }
+          continue;
+        }
+        settled[axis] = 0;
+      }
+      if (steps_left[axis] == 0) {
+        if (distance == 0) { return(FALSE); } // No switch, or one that never releases
+        axes &= ~limit_bit[axis]; 
+        continue;
+      }
+      counter[axis] += increment[axis];
+      if (counter[axis] >= 1000) {
+        counter[axis] -= 1000;
+        out_bits |= step_bit[axis];
+        if (steps_left[axis]) { steps_left[axis]--; }
+      }
+    }
+    out_bits ^= settings.invert_mask;
+    STEPPING_PORT = (STEPPING_PORT & ~DIRECTION_MASK) | (out_bits & DIRECTION_MASK);
+    STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (out_bits & STEP_MASK);
+    delay_us(settings.pulse_microseconds);
+    STEPPING_PORT = (STEPPING_PORT & ~STEP_MASK) | (settings.invert_mask & STEP_MASK);
+    delay_us(step_period-settings.pulse_microseconds);
+  }
+  return(TRUE);
+}
+
+// Homes a group of axes: seek the switches quickly, back off until they release, locate the exact 
+// trigger point at the slow locate rate and pull off to leave the switches released. Returns FALSE
+// when a switch was not found.
+static uint8_t homing_cycle(uint8_t axes)
+{
+  if (!axes) { return(TRUE); }
+  return(homing_move(axes, TRUE, settings.homing_seek_rate, 0, 0) &&
+    homing_move(axes, FALSE, settings.homing_feed_rate, 0, settings.homing_debounce_delay) &&
+    homing_move(axes, TRUE, settings.homing_feed_rate, 0, settings.homing_debounce_delay) &&
+    homing_move(axes, FALSE, settings.homing_seek_rate, settings.homing_pulloff, 0));
+}
+
+// Runs the homing cycle and makes the resulting position machine zero
 void st_go_home()
 {
-  // Todo: Perform the homing cycle
+  st_synchronize();
+  if (alarm) { return; }
+  DISABLE_STEPPER_DRIVER_INTERRUPT(); // The homing cycle drives the stepping port directly
+  steppers_enable();
+  PCICR &= ~(1<<LIMIT_PCIE);          // and hits the switches on purpose
+  if (homing_cycle(HOMING_CYCLE_0) && homing_cycle(HOMING_CYCLE_1)) {
+    plan_set_current_position(0, 0, 0);
+  } else {
+    alarm = ALARM_HOMING_FAIL;        // Stopped short of a switch, the position is unknown
+  }
+  PCIFR = (1<<LIMIT_PCIF);            // Forget the pin changes caused by homing
+  PCICR |= (1<<LIMIT_PCIE);
+  st_idle();
 }
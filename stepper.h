@@ -33,6 +33,18 @@ void st_synchronize();
 // Execute the homing cycle
 void st_go_home();
              
+// The reasons for an alarm
+#define ALARM_HARD_LIMIT 1  // A limit switch was hit
+#define ALARM_HOMING_FAIL 2 // The homing cycle did not find a switch within 1.5 times the travel of the axis
+
+// Non-zero (an ALARM_*) when the position has been lost. All motion has been dropped and is refused 
+// until reset.
+uint8_t st_alarm();
+
+// The number of step events that came due before The Stepper Driver Interrupt was done with the 
+// previous one since power up. Non-zero means the machine is asking for more steps than Grbl can deliver.
+uint16_t st_overruns();
+
 // The stepper subsystem goes to sleep when it runs out of things to execute. Call this
 // to notify the subsystem that it is time to go to work.
 void st_wake_up();